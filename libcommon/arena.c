@@ -0,0 +1,221 @@
+/*****************************************************************************
+ *  Copyright (C) 2004 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Chunks are kept on a list with the one being carved up at the head.
+ * An allocation larger than the chunk size gets a chunk of its own, which
+ * is linked in behind the head so the rest of the head is not wasted.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "xmalloc.h"
+#include "arena.h"
+
+#define ARENA_MAGIC     0xa7e4a000
+/* malloc() alignment on 64-bit targets; xmalloc() only guarantees 8, so
+ * chunk data is rounded up to this boundary rather than trusted to it.
+ */
+#define ARENA_ALIGN     16
+#define _align(n)       (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    int size;                   /* usable bytes following the header */
+    int used;                   /* bytes handed out (always aligned) */
+};
+#define CHUNK_HDR       (sizeof(struct arena_chunk) + ARENA_ALIGN - 1)
+#define _chunk_data(ch) ((char *)(((uintptr_t)((ch) + 1) + ARENA_ALIGN - 1) \
+                                  & ~(uintptr_t)(ARENA_ALIGN - 1)))
+
+struct arena {
+    int magic;
+    int chunksize;
+    struct arena_chunk *chunks; /* head is the chunk being carved up */
+    int allocs;                 /* allocations since last reset */
+    int heap_allocs;            /* chunks allocated since last reset */
+};
+
+Arena arena_create(int chunksize)
+{
+    Arena a = (Arena)xmalloc(sizeof(struct arena));
+
+    assert(chunksize > 0);
+    a->magic = ARENA_MAGIC;
+    a->chunksize = _align(chunksize);
+    a->chunks = NULL;
+    a->allocs = 0;
+    a->heap_allocs = 0;
+    return a;
+}
+
+void arena_reset(Arena a)
+{
+    struct arena_chunk *ch, *keep = NULL;
+
+    assert(a->magic == ARENA_MAGIC);
+    while ((ch = a->chunks)) {
+        a->chunks = ch->next;
+        if (!keep && ch->size == a->chunksize) {
+            keep = ch;
+            continue;
+        }
+        xfree(ch);
+    }
+    if (keep) {
+        memset(_chunk_data(keep), 0, keep->used);
+        keep->used = 0;
+        keep->next = NULL;
+    }
+    a->chunks = keep;
+    a->allocs = 0;
+    a->heap_allocs = 0;
+}
+
+void arena_destroy(Arena a)
+{
+    struct arena_chunk *ch;
+
+    assert(a->magic == ARENA_MAGIC);
+    while ((ch = a->chunks)) {
+        a->chunks = ch->next;
+        xfree(ch);
+    }
+    a->magic = 0;
+    xfree(a);
+}
+
+/* Add a chunk with room for at least size bytes.
+ */
+static struct arena_chunk *_add_chunk(Arena a, int size)
+{
+    struct arena_chunk *ch;
+
+    if (size < a->chunksize)
+        size = a->chunksize;
+    ch = (struct arena_chunk *)xmalloc(CHUNK_HDR + size);
+    ch->size = size;
+    ch->used = 0;
+    if (a->chunks && size > a->chunksize) {
+        ch->next = a->chunks->next;
+        a->chunks->next = ch;
+    } else {
+        ch->next = a->chunks;
+        a->chunks = ch;
+    }
+    a->heap_allocs++;
+    return ch;
+}
+
+void *arena_alloc(Arena a, int size)
+{
+    struct arena_chunk *ch = a->chunks;
+    void *p;
+
+    assert(a->magic == ARENA_MAGIC);
+    assert(size > 0);
+    size = _align(size);
+    if (!ch || ch->size - ch->used < size)
+        ch = _add_chunk(a, size);
+    p = _chunk_data(ch) + ch->used;
+    ch->used += size;
+    a->allocs++;
+    return p;
+}
+
+char *arena_memdup(Arena a, const char *mem, int len)
+{
+    char *cpy = arena_alloc(a, len + 1);
+
+    memcpy(cpy, mem, len);
+    return cpy;
+}
+
+char *arena_strdup(Arena a, const char *str)
+{
+    return arena_memdup(a, str, strlen(str));
+}
+
+/* Format straight into the head chunk if the result fits there,
+ * otherwise allocate exactly enough and format again.
+ */
+char *arena_vsprintf(Arena a, const char *fmt, va_list ap)
+{
+    struct arena_chunk *ch = a->chunks;
+    int len, avail = ch ? ch->size - ch->used : 0;
+    char *str = ch ? _chunk_data(ch) + ch->used : NULL;
+    va_list vacpy;
+
+    assert(a->magic == ARENA_MAGIC);
+    va_copy(vacpy, ap);
+    len = vsnprintf(str, avail, fmt, vacpy);
+    va_end(vacpy);
+    assert(len >= 0);
+    if (len < avail) {
+        ch->used += _align(len + 1);
+        a->allocs++;
+    } else {
+        if (avail > 0)
+            memset(str, 0, avail);      /* keep unused space zeroed */
+        str = arena_alloc(a, len + 1);
+        va_copy(vacpy, ap);
+        vsnprintf(str, len + 1, fmt, vacpy);
+        va_end(vacpy);
+    }
+    return str;
+}
+
+char *arena_sprintf(Arena a, const char *fmt, ...)
+{
+    char *str;
+    va_list ap;
+
+    va_start(ap, fmt);
+    str = arena_vsprintf(a, fmt, ap);
+    va_end(ap);
+
+    return str;
+}
+
+int arena_allocs(Arena a)
+{
+    assert(a->magic == ARENA_MAGIC);
+    return a->allocs;
+}
+
+int arena_heap_allocs(Arena a)
+{
+    assert(a->magic == ARENA_MAGIC);
+    return a->heap_allocs;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
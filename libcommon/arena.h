@@ -0,0 +1,46 @@
+#ifndef PM_ARENA_H
+#define PM_ARENA_H
+
+#include <stdarg.h>
+
+/* An arena hands out memory for short-lived temporaries by bumping a
+ * pointer through large chunks.  Nothing is freed individually: every
+ * allocation is released at once by arena_reset() or arena_destroy().
+ * Memory is zeroed and aligned for any type, as with malloc().
+ */
+typedef struct arena *Arena;
+
+/* Create an arena that grows in chunks of (at least) chunksize bytes.
+ * No memory is allocated until the first arena_alloc().
+ */
+Arena arena_create(int chunksize);
+
+/* Free the arena and everything allocated from it.
+ */
+void arena_destroy(Arena a);
+
+/* Release everything allocated from the arena and zero its counters.
+ * One chunk is kept for reuse.
+ */
+void arena_reset(Arena a);
+
+/* Allocation functions.  These never return NULL.
+ */
+void *arena_alloc(Arena a, int size);
+char *arena_strdup(Arena a, const char *str);
+char *arena_memdup(Arena a, const char *mem, int len); /* NUL terminated */
+char *arena_vsprintf(Arena a, const char *fmt, va_list ap);
+char *arena_sprintf(Arena a, const char *fmt, ...);
+
+/* Counters since the last reset: the number of allocations made from the
+ * arena, and the number of those that had to go to the heap for a new
+ * chunk.  Without the arena, each allocation would be a heap allocation.
+ */
+int arena_allocs(Arena a);
+int arena_heap_allocs(Arena a);
+
+#endif /* PM_ARENA_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
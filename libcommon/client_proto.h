@@ -9,12 +9,32 @@
  * 4. client sends command
  * 5. server sends response (see note under Responses below)
  * If not quit, goto 3
+ *
+ * After the "pipeline" request, the client may send further requests
+ * without waiting for responses and the server stops sending prompts.
+ * Each request must then begin with a tag (up to CP_TAGMAX letters, digits,
+ * '-', '_' or '.') and a space, and every line of its response is prefixed
+ * with the same tag and a space.  Responses to different requests may be
+ * interleaved and complete out of order.  A tag may not be reused until
+ * the response using it is complete.  Up to CP_PIPELINE_MAX commands may be
+ * in progress at once.  A tagged "pipeline" request turns pipelining off.
+ *
+ * A "batch" request carries several of the on, off, cycle, reset, flash,
+ * unflash, status, temp and beacon requests separated by ';', e.g.
+ *   batch off n[0-1]; on n2; cycle n3; status n[0-3]
+ * All nodes are validated before anything is done (one 209 lists every
+ * unknown node), and adjacent parts with the same command are merged.
+ * Each device performs the parts that concern it in order.  The replies
+ * to the parts are sent in order, without their 1XX/2XX lines, followed
+ * by a single 102 or 210 for the whole batch.
  */
 
 #define CP_LINEMAX  8192                /* max request/response line length */
 #define CP_EOL      "\r\n"              /* line terminator */
 #define CP_PROMPT   "powerman> "        /* prompt */
 #define CP_VERSION  "001 %s" CP_EOL
+#define CP_TAGMAX   32                  /* max request tag length */
+#define CP_PIPELINE_MAX 64              /* max commands in progress */
 
 /*
  * Requests
@@ -38,6 +58,11 @@
 #define CP_BEACON_OFF "unflash %s"
 #define CP_TELEMETRY  "telemetry"
 #define CP_EXPRANGE   "exprange"
+#define CP_PIPELINE   "pipeline"
+#define CP_STREAM     "stream"
+#define CP_JSON       "json"
+#define CP_BATCH      "batch %[^\n]"
+#define CP_BATCH_SEP  ";"
 
 /*
  * Responses -
@@ -46,6 +71,26 @@
  * 3XX's are informational messages (more data coming)
  * Responses can be multi-line.  Client knows response is complete when
  * it reads a 1XX or 2XX line.
+ * After the "stream" request, status, temp and beacon queries send a 303
+ * line for each node as soon as the device handling it has responded,
+ * then 303 lines for any nodes left without a result, then the 1XX/2XX.
+ * After the "json" request, the 302/303/304/306/307 lines of status, temp,
+ * beacon, device and nodes replies are replaced by 309 lines, each holding
+ * one JSON object (one per node, or per device for the device query), and
+ * replies to power control commands get a 309 line for each target node:
+ *   309 {"node":"n1","state":"on","value":"ON","device":"d0","plug":"1",
+ *        "error":null}
+ *   309 {"device":"d0","state":"connected","reconnects":0,"actions":3,
+ *        "type":"vpc","nodes":"n[1-2]"}
+ *   309 {"node":"n1","device":"d0","plug":"1"}
+ *   309 {"node":"n1","device":"d0","plug":"1","error":"login timeout"}
+ * "state" is omitted from temp replies, and "value" from power control.
+ * A device's "nodes" is a ranged host list, as in the 306 reply, so that
+ * the line stays within CP_LINEMAX for devices with many plugs.
+ * "value" is the string returned by the device, and "error" the reason
+ * there is none, or the reason a command failed (each may be null).
+ * A command is replied to in the mode in effect when it was issued, so a
+ * pipelined client may turn JSON on for some requests only.
  */
 #define CP_IS_SUCCESS(i) ((i) >= 100 && (i) < 200)
 #define CP_IS_FAILURE(i) ((i) >= 200 && (i) < 300)
@@ -57,6 +102,9 @@
 #define CP_RSP_QRY_COMPLETE "103 Query complete"                    CP_EOL
 #define CP_RSP_TELEMETRY    "104 Telemetry %s"                      CP_EOL
 #define CP_RSP_EXPRANGE     "105 Hostrange expansion %s"            CP_EOL
+#define CP_RSP_PIPELINE     "106 Pipelining %s"                     CP_EOL
+#define CP_RSP_STREAM       "107 Streaming %s"                      CP_EOL
+#define CP_RSP_JSON         "108 JSON %s"                           CP_EOL
 
 /* failure 2xx */
 #define CP_ERR_UNKNOWN      "201 Unknown command"                   CP_EOL
@@ -69,6 +117,7 @@
 #define CP_ERR_COM_COMPLETE "210 Command completed with errors"     CP_EOL
 #define CP_ERR_QRY_COMPLETE "211 Query completed with errors"       CP_EOL
 #define CP_ERR_UNIMPL       "213 Command cannot be handled by power control device(s)" CP_EOL
+#define CP_ERR_TAGINUSE     "214 Tag in use"                        CP_EOL
 
 /* informational 3xx */
 #define CP_INFO_HELP  \
@@ -83,8 +132,12 @@
  "301 beacon [<nodes>]   - query beacon status (if available)"      CP_EOL \
  "301 flash <nodes>      - set beacon to ON (if available)"         CP_EOL \
  "301 unflash <nodes>    - set beacon to OFF (if available)"        CP_EOL \
+ "301 batch <cmd>; ...   - several commands in one request"         CP_EOL \
  "301 telemetry          - toggle telemetry display"                CP_EOL \
  "301 exprange           - toggle host range expansion"             CP_EOL \
+ "301 pipeline           - toggle tagged, pipelined requests"       CP_EOL \
+ "301 stream             - toggle streaming of query results"       CP_EOL \
+ "301 json               - toggle JSON query results"               CP_EOL \
  "301 help               - display help"                            CP_EOL \
  "301 quit               - logout"                                  CP_EOL
 #define CP_INFO_STATUS \
@@ -98,6 +151,7 @@
 #define CP_INFO_NODES       "306 %s"                                CP_EOL
 #define CP_INFO_XNODES      "307 %s"                                CP_EOL
 #define CP_INFO_ACTERROR    "308 %s"                                CP_EOL
+#define CP_INFO_JSON        "309 %s"                                CP_EOL
 
 #endif  /* PM_CLIENT_PROTO_H */
 
@@ -107,15 +107,15 @@ void dbg_wrapped(unsigned long channel, const char *fmt, ...)
 /*
  * Convert memory to string, turning non-printable character into "C"
  * representation.
- *  mem (IN) target memory
- *  len (IN) number of characters to convert
- *  RETURN   string (caller must free)
+ *  str (OUT) buffer of at least DBG_MEMSTR_SIZE(len) bytes
+ *  mem (IN)  target memory
+ *  len (IN)  number of characters to convert
+ *  RETURN    str
  */
-char *dbg_memstr(char *mem, int len)
+char *dbg_memstr_buf(char *str, char *mem, int len)
 {
     int i, j;
     int strsize = len * 4;      /* worst case */
-    char *str = xmalloc(strsize + 1);
 
     for (i = j = 0; i < len; i++) {
         switch (mem[i]) {
@@ -146,6 +146,15 @@ char *dbg_memstr(char *mem, int len)
     return str;
 }
 
+/*
+ * As above but allocate the string.
+ *  RETURN   string (caller must free)
+ */
+char *dbg_memstr(char *mem, int len)
+{
+    return dbg_memstr_buf(xmalloc(DBG_MEMSTR_SIZE(len)), mem, len);
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
@@ -23,6 +23,8 @@ void dbg_notty(void);
 void dbg_setmask(unsigned long mask);
 void dbg_wrapped(unsigned long channel, const char *fmt, ...);
 char *dbg_memstr(char *mem, int len);
+char *dbg_memstr_buf(char *str, char *mem, int len);
+#define DBG_MEMSTR_SIZE(len)    ((len) * 4 + 1)
 
 #define dbg(channel, fmt...)    dbg_wrapped(channel, fmt)
 
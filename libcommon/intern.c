@@ -0,0 +1,149 @@
+/*****************************************************************************
+ *  Copyright (C) 2004 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* The table is an lsd hash mapping each string to its copy.  It is
+ * created on first use and only grows, since names are few compared to
+ * the number of times they are referenced.  lsd hashes keep the bucket
+ * count they were created with, so the table is rebuilt at twice the size
+ * whenever it holds more strings than buckets.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "xtypes.h"
+#include "xmalloc.h"
+#include "hash.h"
+#include "hostlist.h"
+#include "error.h"
+#include "intern.h"
+
+#define INTERN_HASH_SIZE    1024    /* initial size, doubled as needed */
+
+static hash_t intern_tab = NULL;
+static int intern_size = 0;
+static char *intern_buf = NULL;         /* for intern_hostlist_next() */
+static size_t intern_buflen = 0;
+
+char *intern_find(const char *str)
+{
+    assert(str != NULL);
+
+    return intern_tab ? hash_find(intern_tab, str) : NULL;
+}
+
+static int _free(char *s, void *arg)
+{
+    xfree(s);
+    return 0;
+}
+
+static int _insert(char *s, hash_t h)
+{
+    if (!hash_insert(h, s, s))
+        err_exit(TRUE, "hash_insert");
+    return 0;
+}
+
+/* Strings are owned by the table but freed by intern_fini(), not by the
+ * hash, so a rebuild can move them to the new table.
+ */
+static void _resize(int size)
+{
+    hash_t h = hash_create(size, (hash_key_f)hash_key_string,
+                           (hash_cmp_f)strcmp, NULL);
+
+    if (h == NULL)
+        err_exit(TRUE, "hash_create");
+    if (intern_tab) {
+        hash_for_each(intern_tab, (hash_arg_f)_insert, h);
+        hash_destroy(intern_tab);
+    }
+    intern_tab = h;
+    intern_size = size;
+}
+
+char *intern(const char *str)
+{
+    char *s;
+
+    if ((s = intern_find(str)))
+        return s;
+    if (intern_tab == NULL)
+        _resize(INTERN_HASH_SIZE);
+    else if (hash_count(intern_tab) >= intern_size)
+        _resize(intern_size * 2);
+    s = xstrdup(str);
+    _insert(s, intern_tab);
+    return s;
+}
+
+char *intern_hostlist_next(hostlist_iterator_t itr)
+{
+    if (hostlist_next_buf(itr, &intern_buf, &intern_buflen) < 0)
+        return NULL;
+    return intern(intern_buf);
+}
+
+unsigned int intern_hash_key(const char *str)
+{
+    unsigned int h = (unsigned int)((uintptr_t)str >> 4);
+
+    /* Drop alignment bits, then mix so the low bits (lsd hashes take the
+     * key modulo the table size) depend on all the others: small strings
+     * come from malloc at a fixed stride, e.g. 32 bytes apart.
+     */
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
+
+int intern_cmp(const char *s1, const char *s2)
+{
+    return s1 != s2;
+}
+
+void intern_fini(void)
+{
+    if (intern_tab) {
+        hash_for_each(intern_tab, (hash_arg_f)_free, NULL);
+        hash_destroy(intern_tab);
+    }
+    intern_tab = NULL;
+    intern_size = 0;
+    if (intern_buf)
+        free(intern_buf);
+    intern_buf = NULL;
+    intern_buflen = 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
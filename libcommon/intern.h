@@ -0,0 +1,37 @@
+#ifndef PM_INTERN_H
+#define PM_INTERN_H
+
+/* A table of interned strings: one shared, read-only copy of each distinct
+ * string (node and plug names).  Interned strings live until intern_fini(),
+ * so two interned strings are equal if and only if their pointers are.
+ */
+
+/* Return the interned copy of str, adding it to the table if needed.
+ */
+char *intern(const char *str);
+
+/* Return the interned copy of str, or NULL if it has not been interned.
+ */
+char *intern_find(const char *str);
+
+/* Return the interned name of the next host in hostlist iterator itr,
+ * or NULL at the end of the list.  Unlike hostlist_next(), the result
+ * must not be freed, and no memory is allocated for hosts already interned.
+ */
+char *intern_hostlist_next(hostlist_iterator_t itr);
+
+/* hash_key_f and hash_cmp_f functions for lsd hashes whose keys are
+ * all interned strings, so lookups compare pointers.
+ */
+unsigned int intern_hash_key(const char *str);
+int intern_cmp(const char *s1, const char *s2);
+
+/* Free the table and all interned strings.
+ */
+void intern_fini(void);
+
+#endif /* PM_INTERN_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -40,21 +40,37 @@
 
 #include "xtypes.h"
 #include "list.h"
+#include "hash.h"
 #include "xmalloc.h"
 #include "hostlist.h"
 #include "pluglist.h"
+#include "intern.h"
+#include "error.h"
 
 #define PLUGLISTITR_MAGIC   0xfeedfefe
 #define PLUGLIST_MAGIC      0xfeedb0b
 
+/* initial hash size for plug lists without hardwired plugs */
+#define PLUGLIST_HASH_SIZE  256
+
 struct pluglist_iterator {
     int             magic;
     ListIterator    itr;
 };
 
+/* Plugs are kept in a List to preserve their order, and indexed by
+ * plug name and node name for lookups.  Names are interned, so the node
+ * index (whose keys always come from other interned names) compares
+ * pointers.  The indexes are sized by pluglist_map() from the number of
+ * nodes being mapped, since lsd hashes do not grow by themselves.
+ */
 struct pluglist {
     int             magic;
     List	        pluglist;
+    hash_t          byname;     /* plug name -> Plug */
+    hash_t          bynode;     /* node name -> Plug (mapped plugs only) */
+    int             hashsize;   /* bucket count of byname and bynode */
+    ListIterator    freeitr;    /* cursor for _pluglist_map_next() */
     bool            hardwired;
 };
 
@@ -64,8 +80,9 @@ static Plug *_create_plug(char *name)
 
     assert(name != NULL);
 
-    plug->name = xstrdup(name);
+    plug->name = intern(name);
     plug->node = NULL;
+    plug->nodeid = -1;
 
     return plug;
 }
@@ -74,28 +91,72 @@ static void _destroy_plug(Plug *plug)
 {
     assert(plug != NULL);
 
-    xfree(plug->name);
-    if (plug->node)
-        xfree(plug->node);
     xfree(plug);
 }
 
+static void _create_hashes(PlugList pl, int size)
+{
+    pl->byname = hash_create(size, (hash_key_f)hash_key_string,
+                             (hash_cmp_f)strcmp, NULL);
+    pl->bynode = hash_create(size, (hash_key_f)intern_hash_key,
+                             (hash_cmp_f)intern_cmp, NULL);
+    if (pl->byname == NULL || pl->bynode == NULL)
+        err_exit(TRUE, "hash_create");
+    pl->hashsize = size;
+}
+
+/* Make room in the indexes for 'count' more plugs, rebuilding them from
+ * the plug list if they would hold more plugs than buckets.
+ */
+static void _reserve_hashes(PlugList pl, int count)
+{
+    int need = list_count(pl->pluglist) + count;
+    ListIterator itr;
+    Plug *plug;
+
+    if (need <= pl->hashsize)
+        return;
+    hash_destroy(pl->byname);
+    hash_destroy(pl->bynode);
+    _create_hashes(pl, need > pl->hashsize * 2 ? need : pl->hashsize * 2);
+
+    itr = list_iterator_create(pl->pluglist);
+    while ((plug = list_next(itr))) {
+        if (!hash_find(pl->byname, plug->name))  /* first dup wins */
+            hash_insert(pl->byname, plug->name, plug);
+        if (plug->node)
+            hash_insert(pl->bynode, plug->node, plug);
+    }
+    list_iterator_destroy(itr);
+}
+
 PlugList pluglist_create(List plugnames)
 {
     PlugList pl = (PlugList) xmalloc(sizeof(struct pluglist));
+    int size = PLUGLIST_HASH_SIZE;
+
+    if (plugnames && list_count(plugnames) > 0)
+        size = list_count(plugnames);
 
     pl->magic = PLUGLIST_MAGIC;
     pl->pluglist = list_create((ListDelF)_destroy_plug);
+    _create_hashes(pl, size);
+    pl->freeitr = NULL;
     pl->hardwired = FALSE;
 
     /* create plug for each element of plugnames list */
     if (plugnames) {
         ListIterator itr;
         char *name;
+        Plug *plug;
 
         itr = list_iterator_create(plugnames);
-        while ((name = list_next(itr)))
-            list_append(pl->pluglist, _create_plug(name));
+        while ((name = list_next(itr))) {
+            plug = _create_plug(name);
+            list_append(pl->pluglist, plug);
+            if (!hash_find(pl->byname, plug->name))  /* first dup wins */
+                hash_insert(pl->byname, plug->name, plug);
+        }
         list_iterator_destroy(itr);
         pl->hardwired = TRUE;
     }
@@ -109,22 +170,28 @@ void pluglist_destroy(PlugList pl)
     assert(pl->magic == PLUGLIST_MAGIC);
 
     pl->magic = 0;
+    if (pl->freeitr)
+        list_iterator_destroy(pl->freeitr);
+    hash_destroy(pl->byname);
+    hash_destroy(pl->bynode);
     list_destroy(pl->pluglist);
     xfree(pl);
 }
 
 static Plug *_pluglist_find_any(PlugList pl, char *name)
 {
-    PlugListIterator itr = pluglist_iterator_create(pl);
-    Plug *plug;
-
-    while ((plug = pluglist_next(itr))) {
-        if (strcmp(plug->name, name) == 0)
-            break;
-    }
-    pluglist_iterator_destroy(itr);
+    return hash_find(pl->byname, name);
+}
 
-    return plug;
+/* Assign an (interned) node name to a Plug.
+ */
+static pl_err_t _pluglist_set_node(PlugList pl, Plug *plug, char *node)
+{
+    if (hash_find(pl->bynode, node))
+        return EPL_DUPNODE;
+    plug->node = node;
+    hash_insert(pl->bynode, plug->node, plug);
+    return EPL_SUCCESS;
 }
 
 /* Assign a node name to an existing Plug.
@@ -142,35 +209,32 @@ static pl_err_t _pluglist_map_one(PlugList pl, char *node, char *name)
         }
         plug = _create_plug(name);
         list_push(pl->pluglist, plug);
+        hash_insert(pl->byname, plug->name, plug);
     }
     if (plug->node) {
         res = EPL_DUPPLUG;
         goto err;
     }
-    plug->node = xstrdup(node);
+    res = _pluglist_set_node(pl, plug, node);
 err:
     return res;
 }
 
 /* Assign a node name to the next available plug.
+ * Only used with hardwired plugs, so the list does not change and plugs
+ * behind the cursor stay assigned - no need to start over each time.
  */
 static pl_err_t _pluglist_map_next(PlugList pl, char *node)
 {
     Plug *plug;
-    PlugListIterator pitr;
-    pl_err_t res = EPL_NOPLUGS;
-
-    pitr = pluglist_iterator_create(pl);
-    while ((plug = pluglist_next(pitr))) {
-        if (plug->node == NULL) {
-            plug->node = xstrdup(node);
-            res = EPL_SUCCESS;
-            break;
-        }
-    }
-    pluglist_iterator_destroy(pitr);
 
-    return res;
+    if (pl->freeitr == NULL)
+        pl->freeitr = list_iterator_create(pl->pluglist);
+    while ((plug = list_next(pl->freeitr))) {
+        if (plug->node == NULL)
+            return _pluglist_set_node(pl, plug, node);
+    }
+    return EPL_NOPLUGS;
 }
 
 pl_err_t pluglist_map(PlugList pl, char *nodelist, char *pluglist)
@@ -190,12 +254,14 @@ pl_err_t pluglist_map(PlugList pl, char *nodelist, char *pluglist)
         hostlist_iterator_t nitr = hostlist_iterator_create(nhl);
         char *node;
 
-        while ((node = hostlist_next(nitr))) {
+        if (!pl->hardwired)
+            _reserve_hashes(pl, hostlist_count(nhl));
+
+        while ((node = intern_hostlist_next(nitr))) {
             if (pl->hardwired)
                 res = _pluglist_map_next(pl, node);
             else
                 res = _pluglist_map_one(pl, node, node);
-            free(node);
             if (res != EPL_SUCCESS)
                     break;
         }
@@ -212,14 +278,15 @@ pl_err_t pluglist_map(PlugList pl, char *nodelist, char *pluglist)
         hostlist_iterator_t pitr = hostlist_iterator_create(phl);
         char *node, *name;
 
-        while ((node = hostlist_next(nitr))) {
-            name = hostlist_next(pitr);
+        if (!pl->hardwired)
+            _reserve_hashes(pl, hostlist_count(nhl));
+
+        while ((node = intern_hostlist_next(nitr))) {
+            name = intern_hostlist_next(pitr);
             if (name)
                 res = _pluglist_map_one(pl, node, name);
             else
                 res = EPL_NOPLUGS;
-            free(node);
-            free(name);
             if (res != EPL_SUCCESS)
                 break;
         }
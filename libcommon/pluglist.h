@@ -6,9 +6,12 @@
  * context.
  */
 
+/* Plug and node names are interned (see intern.h) and must not be freed.
+ */
 typedef struct {
     char *name;                 /* how the plug is known to the device */
     char *node;                 /* node name */
+    int nodeid;                 /* node id, or -1 (set by powermand) */
 } Plug;
 
 typedef struct pluglist_iterator *PlugListIterator;
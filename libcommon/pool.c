@@ -0,0 +1,112 @@
+/*****************************************************************************
+ *  Copyright (C) 2004 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Retained objects are kept on a stack so the most recently released (and
+ * most likely cached) object is reused first.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "xmalloc.h"
+#include "pool.h"
+
+#define POOL_MAGIC      0x9001f00d
+
+struct pool {
+    int magic;
+    PoolCreateF create;
+    PoolDestroyF destroy;
+    int max;                    /* maximum number of retained objects */
+    int count;                  /* number of retained objects */
+    void **free;                /* stack of retained objects */
+    int gets;                   /* objects handed out */
+    int creates;                /* objects created */
+};
+
+Pool pool_create(int max, PoolCreateF create, PoolDestroyF destroy)
+{
+    Pool p = (Pool)xmalloc(sizeof(struct pool));
+
+    assert(max > 0);
+    assert(create != NULL && destroy != NULL);
+    p->magic = POOL_MAGIC;
+    p->create = create;
+    p->destroy = destroy;
+    p->max = max;
+    p->count = 0;
+    p->free = (void **)xmalloc(sizeof(void *) * max);
+    p->gets = 0;
+    p->creates = 0;
+    return p;
+}
+
+void pool_destroy(Pool p)
+{
+    assert(p->magic == POOL_MAGIC);
+    while (p->count > 0)
+        p->destroy(p->free[--p->count]);
+    xfree(p->free);
+    p->magic = 0;
+    xfree(p);
+}
+
+void *pool_get(Pool p)
+{
+    assert(p->magic == POOL_MAGIC);
+    p->gets++;
+    if (p->count > 0)
+        return p->free[--p->count];
+    p->creates++;
+    return p->create();
+}
+
+void pool_put(Pool p, void *obj)
+{
+    assert(p->magic == POOL_MAGIC);
+    assert(obj != NULL);
+    if (p->count < p->max)
+        p->free[p->count++] = obj;
+    else
+        p->destroy(obj);
+}
+
+int pool_gets(Pool p)
+{
+    assert(p->magic == POOL_MAGIC);
+    return p->gets;
+}
+
+int pool_creates(Pool p)
+{
+    assert(p->magic == POOL_MAGIC);
+    return p->creates;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,41 @@
+#ifndef PM_POOL_H
+#define PM_POOL_H
+
+/* A pool keeps up to a fixed number of released objects of one kind on a
+ * free list so they can be handed out again without going to the heap.
+ * Objects are created and destroyed by functions supplied by the caller,
+ * which also resets an object's state before releasing it.
+ */
+typedef struct pool *Pool;
+
+typedef void *(*PoolCreateF)(void);
+typedef void (*PoolDestroyF)(void *obj);
+
+/* Create a pool that retains at most max released objects.
+ */
+Pool pool_create(int max, PoolCreateF create, PoolDestroyF destroy);
+
+/* Destroy the pool and the objects it retains.  Objects that are still
+ * in use are not affected.
+ */
+void pool_destroy(Pool p);
+
+/* Return a retained object, or a newly created one if there are none.
+ */
+void *pool_get(Pool p);
+
+/* Release obj to the pool, or destroy it if the pool is full.
+ */
+void pool_put(Pool p, void *obj);
+
+/* Counters: objects handed out by pool_get() and how many of those had
+ * to be created.
+ */
+int pool_gets(Pool p);
+int pool_creates(Pool p);
+
+#endif /* PM_POOL_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -220,10 +220,10 @@ xregex_match_strlen(xregex_match_t xm)
     return xm->xm_pmatch[0].rm_eo;
 }
 
-char *
-xregex_match_sub_strdup(xregex_match_t xm, int i)
+const char *
+xregex_match_sub(xregex_match_t xm, int i, int *lenp)
 {
-    char *s = NULL;
+    const char *s = NULL;
 
     assert(xm->xm_magic == XREGEX_MATCH_MAGIC);
     assert(xm->xm_used);
@@ -234,9 +234,23 @@ xregex_match_sub_strdup(xregex_match_t xm, int i)
 
         assert(xm->xm_str != NULL);
         assert(m.rm_so < m.rm_eo);
-        s = xmalloc(m.rm_eo - m.rm_so + 1);
-        memcpy(s, xm->xm_str + m.rm_so, m.rm_eo - m.rm_so);
-        s[m.rm_eo - m.rm_so] = '\0';
+        s = xm->xm_str + m.rm_so;
+        *lenp = m.rm_eo - m.rm_so;
+    }
+    return s;
+}
+
+char *
+xregex_match_sub_strdup(xregex_match_t xm, int i)
+{
+    const char *sub;
+    char *s = NULL;
+    int len;
+
+    if ((sub = xregex_match_sub(xm, i, &len))) {
+        s = xmalloc(len + 1);
+        memcpy(s, sub, len);
+        s[len] = '\0';
     }
     return s;
 }
@@ -44,6 +44,12 @@ void xregex_match_recycle(xregex_match_t xm);
  */
 char *xregex_match_sub_strdup(xregex_match_t xm, int index);
 
+/* Like xregex_match_sub_strdup() but return a pointer to the match within
+ * the matched string and set *lenp to its length instead of making a copy.
+ * The result is not NUL terminated and is valid until the match is recycled.
+ */
+const char *xregex_match_sub(xregex_match_t xm, int index, int *lenp);
+
 /* Similar to xregex_match_sub_strdup(xm, 0) but includes unmatched
  * leading text.  Caller must free result with xfree().
  */
@@ -197,6 +197,48 @@ struct hostlist_iterator {
     struct hostlist_iterator *next;
 };
 
+/* number of suffix bits held by one hostbits chunk */
+#define HOSTBITS_WORD       (sizeof(unsigned long) * 8)
+#define HOSTBITS_WORDS      16
+#define HOSTBITS_CHUNK      (HOSTBITS_WORD * HOSTBITS_WORDS)
+
+/* pad width used for hosts without a valid numeric suffix */
+#define HOSTBITS_SINGLE     -1
+
+/* a fixed size piece of a suffix bitmap: bit i of the chunk stands
+ * for suffix (idx * HOSTBITS_CHUNK + i)
+ */
+struct hostbits_chunk {
+    unsigned long idx;
+    unsigned long bits[HOSTBITS_WORDS];
+};
+
+/* all hosts sharing a prefix and zero padding: a sparse bitmap of
+ * suffixes stored as an array of chunks sorted by idx
+ */
+struct hostbits_prefix {
+    char *prefix;           /* stored once per (prefix, width)        */
+
+    /* zero padded width of the suffix, 0 if the suffix is not padded,
+     * or HOSTBITS_SINGLE if the prefix is the whole hostname         */
+    int width;
+
+    int nchunks;            /* number of chunks in use                */
+    int size;               /* number of chunks allocated             */
+    struct hostbits_chunk *chunk;
+};
+
+/* The hostbits type: an array of prefixes sorted by (prefix, width) */
+struct hostbits {
+#ifndef NDEBUG
+#define HOSTBITS_MAGIC    57007
+    int magic;
+#endif
+    int nprefixes;          /* number of prefixes in use              */
+    int size;               /* number of prefixes allocated           */
+    struct hostbits_prefix *bp;
+};
+
 
 /* ---- ---- */
 
@@ -2203,6 +2245,47 @@ ssize_t hostlist_ranged_string(hostlist_t hl, size_t n, char *buf)
     return truncated ? -1 : len;
 }
 
+/* Like hostlist_ranged_string(), but grow the buffer as needed.  A
+ * bracketed list that does not fit is rewritten after doubling the buffer,
+ * so the total work stays linear in the length of the result.
+ */
+char *hostlist_ranged_string_malloc(hostlist_t hl)
+{
+    size_t size = MAXHOSTRANGELEN;
+    size_t len = 0;
+    char *buf, *new;
+    int i = 0;
+
+    if (!(buf = malloc(size)))
+        out_of_memory("hostlist ranged string");
+
+    LOCK_HOSTLIST(hl);
+    while (i < hl->nranges) {
+        int start = i;
+        int m = _get_bracketed_list(hl, &i, size - len, buf + len);
+
+        /* need room for a separator and the terminating NUL */
+        if (m < 0 || m + 1 >= size - len) {
+            if (!(new = realloc(buf, size * 2))) {
+                UNLOCK_HOSTLIST(hl);
+                free(buf);
+                out_of_memory("hostlist ranged string");
+            }
+            buf = new;
+            size *= 2;
+            i = start;
+            continue;
+        }
+        len += m;
+        if (i < hl->nranges)
+            buf[len++] = ',';
+    }
+    UNLOCK_HOSTLIST(hl);
+    buf[len] = '\0';
+
+    return buf;
+}
+
 /* ----[ hostlist iterator functions ]---- */
 
 static hostlist_iterator_t hostlist_iterator_new(void)
@@ -2336,6 +2419,46 @@ char *hostlist_next(hostlist_iterator_t i)
     return (buf);
 }
 
+ssize_t hostlist_next_buf(hostlist_iterator_t i, char **buf, size_t *n)
+{
+    char suffix[16];
+    size_t len;
+    assert(i != NULL);
+    assert(i->magic == HOSTLIST_MAGIC);
+    assert(buf != NULL && n != NULL);
+    LOCK_HOSTLIST(i->hl);
+    _iterator_advance(i);
+
+    if (i->idx > i->hl->nranges - 1) {
+        UNLOCK_HOSTLIST(i->hl);
+        return -1;
+    }
+
+    suffix[0] = '\0';
+
+    if (!i->hr->singlehost)
+        snprintf (suffix, 15, "%0*lu", i->hr->width, i->hr->lo + i->depth);
+
+    len = strlen (i->hr->prefix) + strlen (suffix) + 1;
+    if (*buf == NULL || *n < len) {
+        char *new = realloc (*buf, len);
+
+        if (new == NULL) {
+            UNLOCK_HOSTLIST(i->hl);
+            errno = ENOMEM;
+            return -1;
+        }
+        *buf = new;
+        *n = len;
+    }
+
+    strcpy (*buf, i->hr->prefix);
+    strcat (*buf, suffix);
+
+    UNLOCK_HOSTLIST(i->hl);
+    return (len - 1);
+}
+
 char *hostlist_next_range(hostlist_iterator_t i)
 {
     char buf[MAXHOSTRANGELEN + 1];
@@ -2591,6 +2714,609 @@ ssize_t hostset_deranged_string(hostset_t set, size_t n, char *buf)
     return hostlist_deranged_string(set->hl, n, buf);
 }
 
+/* ----[ hostbits functions ]---- */
+
+static int _hostbits_popcount(unsigned long w)
+{
+    int n = 0;
+
+    while (w) {
+        w &= w - 1;
+        n++;
+    }
+    return n;
+}
+
+/* return the number of decimal digits in num */
+static int _hostbits_digits(unsigned long num)
+{
+    int n = 1;
+
+    while (num /= 10L)
+        n++;
+    return n;
+}
+
+/* return the smallest suffix that fills a pad width of "width"
+ * without zero padding, or 0 if every valid suffix would be padded
+ */
+static unsigned long _hostbits_pad_limit(int width)
+{
+    unsigned long limit = 1;
+    int i;
+
+    for (i = 1; i < width; i++) {
+        if (limit > MAX_HOST_SUFFIX)
+            return 0;
+        limit *= 10;
+    }
+    return limit;
+}
+
+/* binary search for (prefix, width) in hb.
+ * Returns the index of the prefix if found, otherwise -(i + 1) where
+ * i is the position it would be inserted at.
+ */
+static int hostbits_find_prefix(hostbits_t hb, const char *prefix, int width)
+{
+    int lo = 0, hi = hb->nprefixes - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(hb->bp[mid].prefix, prefix);
+
+        if (cmp == 0)
+            cmp = hb->bp[mid].width - width;
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -(lo + 1);
+}
+
+/* return the (prefix, width) entry of hb, creating it if necessary
+ * Returns NULL if memory allocation fails.
+ */
+static struct hostbits_prefix *
+hostbits_get_prefix(hostbits_t hb, const char *prefix, int width)
+{
+    struct hostbits_prefix *bp;
+    int i = hostbits_find_prefix(hb, prefix, width);
+
+    if (i >= 0)
+        return &hb->bp[i];
+    i = -i - 1;
+
+    if (hb->nprefixes == hb->size) {
+        int size = hb->size + HOSTLIST_CHUNK;
+
+        if (!(bp = realloc(hb->bp, size * sizeof(*bp))))
+            out_of_memory("hostbits prefix");
+        hb->bp = bp;
+        hb->size = size;
+    }
+    memmove(&hb->bp[i + 1], &hb->bp[i],
+            (hb->nprefixes - i) * sizeof(*hb->bp));
+
+    bp = &hb->bp[i];
+    if (!(bp->prefix = strdup(prefix))) {
+        memmove(&hb->bp[i], &hb->bp[i + 1],
+                (hb->nprefixes - i) * sizeof(*hb->bp));
+        out_of_memory("hostbits prefix");
+    }
+    bp->width = width;
+    bp->nchunks = 0;
+    bp->size = 0;
+    bp->chunk = NULL;
+    hb->nprefixes++;
+
+    return bp;
+}
+
+/* binary search for chunk idx in bp, see hostbits_find_prefix() */
+static int hostbits_find_chunk(struct hostbits_prefix *bp, unsigned long idx)
+{
+    int lo = 0, hi = bp->nchunks - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+
+        if (bp->chunk[mid].idx == idx)
+            return mid;
+        if (bp->chunk[mid].idx < idx)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -(lo + 1);
+}
+
+/* return chunk idx of bp, creating an empty one if necessary
+ * Returns NULL if memory allocation fails.
+ */
+static struct hostbits_chunk *
+hostbits_get_chunk(struct hostbits_prefix *bp, unsigned long idx)
+{
+    struct hostbits_chunk *c;
+    int i = hostbits_find_chunk(bp, idx);
+
+    if (i >= 0)
+        return &bp->chunk[i];
+    i = -i - 1;
+
+    if (bp->nchunks == bp->size) {
+        int size = bp->size ? bp->size * 2 : 1;
+
+        if (!(c = realloc(bp->chunk, size * sizeof(*c))))
+            out_of_memory("hostbits chunk");
+        bp->chunk = c;
+        bp->size = size;
+    }
+    memmove(&bp->chunk[i + 1], &bp->chunk[i],
+            (bp->nchunks - i) * sizeof(*bp->chunk));
+    bp->nchunks++;
+
+    c = &bp->chunk[i];
+    memset(c, 0, sizeof(*c));
+    c->idx = idx;
+
+    return c;
+}
+
+/* drop empty chunks from bp, and prefixes without chunks from hb
+ */
+static void hostbits_compact(hostbits_t hb)
+{
+    int i, j, k, w;
+
+    for (i = 0, j = 0; i < hb->nprefixes; i++) {
+        struct hostbits_prefix *bp = &hb->bp[i];
+
+        for (k = 0, w = 0; k < bp->nchunks; k++) {
+            int empty = 1, n;
+
+            for (n = 0; n < HOSTBITS_WORDS && empty; n++)
+                empty = (bp->chunk[k].bits[n] == 0);
+            if (!empty)
+                bp->chunk[w++] = bp->chunk[k];
+        }
+        bp->nchunks = w;
+
+        if (bp->nchunks == 0) {
+            free(bp->chunk);
+            free(bp->prefix);
+        } else
+            hb->bp[j++] = *bp;
+    }
+    hb->nprefixes = j;
+}
+
+/* set suffixes lo through hi of (prefix, width) in hb
+ * Returns the number of hosts that were not already set, or -1 if
+ * memory allocation fails.
+ */
+static int hostbits_set(hostbits_t hb, const char *prefix, int width,
+                        unsigned long lo, unsigned long hi)
+{
+    struct hostbits_prefix *bp;
+    unsigned long n;
+    int added = 0;
+
+    if (!(bp = hostbits_get_prefix(hb, prefix, width)))
+        return -1;
+
+    for (n = lo; n <= hi; ) {
+        unsigned long word = n / HOSTBITS_WORD;
+        unsigned long end = (word + 1) * HOSTBITS_WORD - 1;
+        unsigned long mask;
+        struct hostbits_chunk *c;
+        unsigned long *w;
+
+        if (end > hi)
+            end = hi;
+
+        if (!(c = hostbits_get_chunk(bp, n / HOSTBITS_CHUNK)))
+            return -1;
+        w = &c->bits[word % HOSTBITS_WORDS];
+
+        mask = (~0UL << (n % HOSTBITS_WORD))
+             & (~0UL >> (HOSTBITS_WORD - 1 - end % HOSTBITS_WORD));
+        added += _hostbits_popcount(mask & ~*w);
+        *w |= mask;
+
+        if (end == (unsigned long) -1)
+            break;
+        n = end + 1;
+    }
+
+    return added;
+}
+
+/* add the hosts in hostrange hr to hb
+ * Returns number of hosts added, or -1 if memory allocation fails.
+ */
+static int hostbits_insert_range(hostbits_t hb, hostrange_t hr)
+{
+    unsigned long lo = hr->lo;
+    int n, added = 0;
+
+    if (hr->singlehost)
+        return hostbits_set(hb, hr->prefix, HOSTBITS_SINGLE, 0, 0);
+
+    /* suffixes with fewer digits than the width are zero padded */
+    if (hr->width > 1) {
+        unsigned long limit = _hostbits_pad_limit(hr->width);
+
+        if (limit == 0 || lo < limit) {
+            unsigned long hi = (limit == 0 || hr->hi < limit) 
+                             ? hr->hi : limit - 1;
+
+            if ((added = hostbits_set(hb, hr->prefix, hr->width, lo, hi)) < 0)
+                return -1;
+            if (hi == hr->hi)
+                return added;
+            lo = limit;
+        }
+    }
+    if ((n = hostbits_set(hb, hr->prefix, 0, lo, hr->hi)) < 0)
+        return -1;
+
+    return added + n;
+}
+
+/* look up hostname hn in hb, returning 1 if found, 0 otherwise
+ */
+static int hostbits_hn_within(hostbits_t hb, hostname_t hn)
+{
+    const char *prefix = hn->hostname;
+    unsigned long num = 0;
+    unsigned long bit;
+    int width = HOSTBITS_SINGLE;
+    struct hostbits_prefix *bp;
+    int i;
+
+    if (hostname_suffix_is_valid(hn)) {
+        prefix = hn->prefix;
+        num = hn->num;
+        width = hostname_suffix_width(hn);
+        if (_zero_padded(num, width) == 0)
+            width = 0;
+    }
+
+    if ((i = hostbits_find_prefix(hb, prefix, width)) < 0)
+        return 0;
+    bp = &hb->bp[i];
+    if ((i = hostbits_find_chunk(bp, num / HOSTBITS_CHUNK)) < 0)
+        return 0;
+    bit = num % HOSTBITS_CHUNK;
+
+    return (bp->chunk[i].bits[bit / HOSTBITS_WORD] >> (bit % HOSTBITS_WORD)) & 1;
+}
+
+/* push the run lo-hi of bp onto hostlist hl
+ */
+static int hostbits_push_run(hostlist_t hl, struct hostbits_prefix *bp,
+                             unsigned long lo, unsigned long hi)
+{
+    int width = bp->width;
+
+    if (width == HOSTBITS_SINGLE) {
+        hostrange_t hr = hostrange_create_single(bp->prefix);
+        int retval;
+
+        if (hr == NULL)
+            return -1;
+        retval = hostlist_push_range(hl, hr);
+        hostrange_destroy(hr);
+        return retval;
+    }
+
+    /* an unpadded range is formatted as if parsed from its first host */
+    if (width == 0)
+        width = _hostbits_digits(lo);
+    return hostlist_push_hr(hl, bp->prefix, lo, hi, width);
+}
+
+hostbits_t hostbits_create(const char *hosts)
+{
+    hostbits_t new;
+
+    if (!(new = (hostbits_t) malloc(sizeof(*new))))
+        out_of_memory("hostbits create");
+
+    assert((new->magic = HOSTBITS_MAGIC));
+    new->nprefixes = 0;
+    new->size = 0;
+    new->bp = NULL;
+
+    if (hosts != NULL && hostbits_insert(new, hosts) < 0) {
+        hostbits_destroy(new);
+        return NULL;
+    }
+    return new;
+}
+
+void hostbits_destroy(hostbits_t hb)
+{
+    int i;
+
+    if (hb == NULL)
+        return;
+    assert(hb->magic == HOSTBITS_MAGIC);
+    for (i = 0; i < hb->nprefixes; i++) {
+        free(hb->bp[i].prefix);
+        free(hb->bp[i].chunk);
+    }
+    free(hb->bp);
+    assert((hb->magic = ~HOSTBITS_MAGIC));
+    free(hb);
+}
+
+int hostbits_insert(hostbits_t hb, const char *hosts)
+{
+    hostlist_t hl;
+    int n;
+
+    if (!(hl = hostlist_create(hosts)))
+        return -1;
+    n = hostbits_insert_list(hb, hl);
+    hostlist_destroy(hl);
+    return n;
+}
+
+int hostbits_insert_list(hostbits_t hb, hostlist_t hl)
+{
+    int i, m, n = 0;
+
+    assert(hb->magic == HOSTBITS_MAGIC);
+    LOCK_HOSTLIST(hl);
+    for (i = 0; i < hl->nranges; i++) {
+        if ((m = hostbits_insert_range(hb, hl->hr[i])) < 0) {
+            n = -1;
+            break;
+        }
+        n += m;
+    }
+    UNLOCK_HOSTLIST(hl);
+    return n;
+}
+
+int hostbits_insert_host(hostbits_t hb, const char *host)
+{
+    hostname_t hn;
+    int width, n;
+
+    assert(hb->magic == HOSTBITS_MAGIC);
+    if (!(hn = hostname_create(host)))
+        return -1;
+
+    if (hostname_suffix_is_valid(hn)) {
+        width = hostname_suffix_width(hn);
+        if (_zero_padded(hn->num, width) == 0)
+            width = 0;
+        n = hostbits_set(hb, hn->prefix, width, hn->num, hn->num);
+    } else
+        n = hostbits_set(hb, hn->hostname, HOSTBITS_SINGLE, 0, 0);
+
+    hostname_destroy(hn);
+    return n;
+}
+
+int hostbits_find(hostbits_t hb, const char *host)
+{
+    hostname_t hn;
+    int retval;
+
+    assert(hb->magic == HOSTBITS_MAGIC);
+    if (!(hn = hostname_create(host)))
+        return 0;
+    retval = hostbits_hn_within(hb, hn);
+    hostname_destroy(hn);
+    return retval;
+}
+
+int hostbits_union(hostbits_t dst, hostbits_t src)
+{
+    int i, j, k;
+
+    assert(dst->magic == HOSTBITS_MAGIC);
+    assert(src->magic == HOSTBITS_MAGIC);
+    if (dst == src)
+        return 0;
+
+    for (i = 0; i < src->nprefixes; i++) {
+        struct hostbits_prefix *sp = &src->bp[i];
+        struct hostbits_prefix *dp;
+
+        if (!(dp = hostbits_get_prefix(dst, sp->prefix, sp->width)))
+            return -1;
+        for (j = 0; j < sp->nchunks; j++) {
+            struct hostbits_chunk *c;
+
+            if (!(c = hostbits_get_chunk(dp, sp->chunk[j].idx)))
+                return -1;
+            for (k = 0; k < HOSTBITS_WORDS; k++)
+                c->bits[k] |= sp->chunk[j].bits[k];
+        }
+    }
+    return 0;
+}
+
+void hostbits_intersect(hostbits_t dst, hostbits_t src)
+{
+    int i, j, k, m;
+
+    assert(dst->magic == HOSTBITS_MAGIC);
+    assert(src->magic == HOSTBITS_MAGIC);
+
+    for (i = 0; i < dst->nprefixes; i++) {
+        struct hostbits_prefix *dp = &dst->bp[i];
+        struct hostbits_prefix *sp;
+
+        if ((m = hostbits_find_prefix(src, dp->prefix, dp->width)) < 0) {
+            dp->nchunks = 0;
+            continue;
+        }
+        sp = &src->bp[m];
+        for (j = 0; j < dp->nchunks; j++) {
+            struct hostbits_chunk *c = &dp->chunk[j];
+
+            if ((m = hostbits_find_chunk(sp, c->idx)) < 0)
+                memset(c->bits, 0, sizeof(c->bits));
+            else {
+                for (k = 0; k < HOSTBITS_WORDS; k++)
+                    c->bits[k] &= sp->chunk[m].bits[k];
+            }
+        }
+    }
+    hostbits_compact(dst);
+}
+
+void hostbits_subtract(hostbits_t dst, hostbits_t src)
+{
+    int i, j, k, m;
+
+    assert(dst->magic == HOSTBITS_MAGIC);
+    assert(src->magic == HOSTBITS_MAGIC);
+
+    for (i = 0; i < dst->nprefixes; i++) {
+        struct hostbits_prefix *dp = &dst->bp[i];
+        struct hostbits_prefix *sp;
+
+        if ((m = hostbits_find_prefix(src, dp->prefix, dp->width)) < 0)
+            continue;
+        sp = &src->bp[m];
+        for (j = 0; j < dp->nchunks; j++) {
+            struct hostbits_chunk *c = &dp->chunk[j];
+
+            if ((m = hostbits_find_chunk(sp, c->idx)) < 0)
+                continue;
+            for (k = 0; k < HOSTBITS_WORDS; k++)
+                c->bits[k] &= ~sp->chunk[m].bits[k];
+        }
+    }
+    hostbits_compact(dst);
+}
+
+int hostbits_count(hostbits_t hb)
+{
+    int i, j, k, n = 0;
+
+    assert(hb->magic == HOSTBITS_MAGIC);
+    for (i = 0; i < hb->nprefixes; i++) {
+        struct hostbits_prefix *bp = &hb->bp[i];
+
+        for (j = 0; j < bp->nchunks; j++) {
+            for (k = 0; k < HOSTBITS_WORDS; k++)
+                n += _hostbits_popcount(bp->chunk[j].bits[k]);
+        }
+    }
+    return n;
+}
+
+int hostbits_is_empty(hostbits_t hb)
+{
+    int i, j, k;
+
+    assert(hb->magic == HOSTBITS_MAGIC);
+    for (i = 0; i < hb->nprefixes; i++) {
+        struct hostbits_prefix *bp = &hb->bp[i];
+
+        for (j = 0; j < bp->nchunks; j++) {
+            for (k = 0; k < HOSTBITS_WORDS; k++) {
+                if (bp->chunk[j].bits[k] != 0)
+                    return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Walk the bitmaps a word at a time, pushing one range per run of
+ * consecutive suffixes, so the cost depends on the number of runs rather
+ * than the number of hosts.
+ */
+hostlist_t hostbits_hostlist(hostbits_t hb)
+{
+    hostlist_t hl;
+    int i, j, k, b;
+
+    assert(hb->magic == HOSTBITS_MAGIC);
+    if (!(hl = hostlist_new()))
+        return NULL;
+
+    for (i = 0; i < hb->nprefixes; i++) {
+        struct hostbits_prefix *bp = &hb->bp[i];
+        unsigned long lo = 0, hi = 0;
+        int inrun = 0;
+
+        for (j = 0; j < bp->nchunks; j++) {
+            struct hostbits_chunk *c = &bp->chunk[j];
+
+            for (k = 0; k < HOSTBITS_WORDS; k++) {
+                unsigned long w = c->bits[k];
+                unsigned long base = c->idx * HOSTBITS_CHUNK 
+                                   + k * HOSTBITS_WORD;
+
+                if (w == 0UL)
+                    continue;
+                if (w == ~0UL && inrun && hi + 1 == base) {
+                    hi = base + HOSTBITS_WORD - 1;
+                    continue;
+                }
+                for (b = 0; b < HOSTBITS_WORD; b++) {
+                    if (!((w >> b) & 1))
+                        continue;
+                    if (inrun && hi + 1 == base + b) {
+                        hi++;
+                        continue;
+                    }
+                    if (inrun && hostbits_push_run(hl, bp, lo, hi) < 0)
+                        goto error;
+                    lo = hi = base + b;
+                    inrun = 1;
+                }
+            }
+        }
+        if (inrun && hostbits_push_run(hl, bp, lo, hi) < 0)
+            goto error;
+    }
+
+    hostlist_sort(hl);
+    return hl;
+
+  error:
+    hostlist_destroy(hl);
+    return NULL;
+}
+
+ssize_t hostbits_ranged_string(hostbits_t hb, size_t n, char *buf)
+{
+    hostlist_t hl;
+    ssize_t retval;
+
+    if (!(hl = hostbits_hostlist(hb)))
+        return -1;
+    retval = hostlist_ranged_string(hl, n, buf);
+    hostlist_destroy(hl);
+    return retval;
+}
+
+char *hostbits_ranged_string_malloc(hostbits_t hb)
+{
+    hostlist_t hl;
+    char *retval;
+
+    if (!(hl = hostbits_hostlist(hb)))
+        return NULL;
+    retval = hostlist_ranged_string_malloc(hl);
+    hostlist_destroy(hl);
+    return retval;
+}
+
 #if TEST_MAIN 
 
 int hostlist_nranges(hostlist_t hl)
@@ -65,6 +65,13 @@ typedef struct hostlist * hostlist_t;
  */
 typedef struct hostset * hostset_t;
 
+/* A hostbits is a set of hosts like a hostset, but stored as a bitmap
+ * of numeric suffixes for each distinct prefix. Insertion, membership
+ * and set operations cost a few word operations per run of hosts,
+ * rather than string work per host. Not safe for concurrent use.
+ */
+typedef struct hostbits * hostbits_t;
+
 /* The hostlist iterator type (may be used with a hostset as well)
  * used for non-destructive access to hostlist members.
  * 
@@ -281,6 +288,16 @@ void hostlist_uniq(hostlist_t hl);
 ssize_t hostlist_ranged_string(hostlist_t hl, size_t n, char *buf);
 ssize_t hostset_ranged_string(hostset_t hs, size_t n, char *buf);
 
+/* hostlist_ranged_string_malloc():
+ *
+ * Same as hostlist_ranged_string(), but the result is written into a
+ * buffer of the right size, built in one pass.  Returns NULL if memory
+ * allocation fails.
+ *
+ * The caller is responsible for freeing the returned memory.
+ */
+char *hostlist_ranged_string_malloc(hostlist_t hl);
+
 /* hostlist_deranged_string():
  *
  * Writes the string representation of the hostlist hl into buf,
@@ -341,6 +358,17 @@ void hostlist_iterator_reset(hostlist_iterator_t i);
  */ 
 char * hostlist_next(hostlist_iterator_t i);
 
+/* hostlist_next_buf():
+ *
+ * Same as hostlist_next(), but copies the hostname into *buf, which is
+ * grown with realloc() if it is smaller than needed (*n is its size).
+ * Returns the length of the hostname, or -1 at the end of the list
+ * or on memory allocation failure (errno set to ENOMEM).
+ *
+ * The caller is responsible for freeing *buf.
+ */
+ssize_t hostlist_next_buf(hostlist_iterator_t i, char **buf, size_t *n);
+
 
 /* hostlist_next_range():
  *
@@ -416,4 +444,65 @@ char * hostset_shift_range(hostset_t set);
 int hostset_count(hostset_t set);
 
 
+/* ----[ hostbits operations ]---- */
+
+/* hostbits_create():
+ *
+ * Create a new hostbits object from a string representation of a list of
+ * hosts (see hostlist_create()), or an empty one if "hosts" is NULL.
+ * Returns NULL on failure.
+ */
+hostbits_t hostbits_create(const char *hosts);
+
+/* hostbits_destroy():
+ */
+void hostbits_destroy(hostbits_t hb);
+
+/* hostbits_insert(), hostbits_insert_list(), hostbits_insert_host():
+ *
+ * Add a string list of hosts, the hosts in hostlist "hl", or the single
+ * host "host" to "hb". Returns the number of hosts that were not already
+ * in "hb", or -1 on failure.
+ */
+int hostbits_insert(hostbits_t hb, const char *hosts);
+int hostbits_insert_list(hostbits_t hb, hostlist_t hl);
+int hostbits_insert_host(hostbits_t hb, const char *host);
+
+/* hostbits_find():
+ *
+ * Return 1 if "host" is in "hb", 0 otherwise.
+ */
+int hostbits_find(hostbits_t hb, const char *host);
+
+/* hostbits_union(), hostbits_intersect(), hostbits_subtract():
+ *
+ * Replace "dst" by its union with, intersection with, or difference
+ * from "src". hostbits_union() returns 0, or -1 if memory allocation
+ * fails (in which case "dst" may be partially updated).
+ */
+int  hostbits_union(hostbits_t dst, hostbits_t src);
+void hostbits_intersect(hostbits_t dst, hostbits_t src);
+void hostbits_subtract(hostbits_t dst, hostbits_t src);
+
+/* hostbits_count(), hostbits_is_empty():
+ */
+int hostbits_count(hostbits_t hb);
+int hostbits_is_empty(hostbits_t hb);
+
+/* hostbits_hostlist():
+ *
+ * Return a new sorted hostlist of the hosts in "hb", or NULL on failure.
+ * The caller must free the result with hostlist_destroy().
+ */
+hostlist_t hostbits_hostlist(hostbits_t hb);
+
+/* hostbits_ranged_string(), hostbits_ranged_string_malloc():
+ *
+ * Same as hostset_ranged_string() and hostlist_ranged_string_malloc()
+ * for the hosts in "hb".
+ */
+ssize_t hostbits_ranged_string(hostbits_t hb, size_t n, char *buf);
+char *  hostbits_ranged_string_malloc(hostbits_t hb);
+
+
 #endif /* !_HOSTLIST_H */
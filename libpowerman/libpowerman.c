@@ -32,6 +32,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -47,117 +49,121 @@
 #ifndef MAXPORTNAMELEN
 #define MAXPORTNAMELEN 64
 #endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Longest a waiting thread sleeps in poll() before looking again for
+ * responses another thread may have read (e.g. with pm_poll()).
+ */
+#define PM_WAIT_POLL_MS 1000
 
 
+/* Requests are sent on the connection as they are submitted and their
+ * responses are parsed as lines arrive, so several can be in progress
+ * at once.  Once the server has agreed to pipelining, each request is
+ * tagged and the tag on each response line says which request it is for.
+ * Otherwise only one request may be in progress at a time.
+ * Lines are parsed in place in the receive buffer: per-node results are
+ * added to the request's result as they go by, and nothing else is kept.
+ *
+ * A handle may be shared by several threads.  Each public call holds
+ * pmh_lock while it uses the handle.  A thread waiting for a response
+ * reads on behalf of all of them, and the others sleep on pmh_cond until
+ * it has read something.  If the connection is lost, requests still in
+ * progress fail with the error, and a PM_CONN_PERSIST handle connects
+ * again when the next request is submitted.
+ */
 #define PMH_MAGIC 0x44445555
 struct pm_handle_struct {
-    int         pmh_magic;
-    int         pmh_fd;
+    int                 pmh_magic;
+    int                 pmh_fd;         /* -1 if not connected */
+    int                 pmh_flags;      /* flags from pm_connect() */
+    char *              pmh_server;     /* server to connect to, or NULL */
+    pthread_mutex_t     pmh_lock;
+    pthread_cond_t      pmh_cond;       /* broadcast after each read */
+    int                 pmh_reading;    /* a thread is waiting in poll() */
+    char *              pmh_buf;        /* received data not yet parsed */
+    int                 pmh_buflen;     /* size of pmh_buf */
+    int                 pmh_count;      /* bytes of data in pmh_buf */
+    int                 pmh_scan;       /* bytes known to hold no newline */
+    int                 pmh_json;       /* server can send JSON results */
+    int                 pmh_json_on;    /* ...and will for the next request */
+    int                 pmh_pipeline;   /* server takes tagged requests */
+    int                 pmh_tagseq;     /* tag of last request */
+    struct pm_request_struct *pmh_reqs; /* submitted requests, oldest first */
 };
 
+/* Node names and error causes are kept in one string buffer per result,
+ * and referred to by offset since the buffer moves as it grows.
+ */
+struct pm_node_result {
+    int                 node;           /* offset of node name */
+    int                 errstr;         /* offset of cause from server, or -1 */
+    pm_node_state_t     state;
+    pm_err_t            err;
+};
 
-typedef void (*list_free_t) (void *x);
-struct list_struct {
-    char *              data;
-    struct list_struct *next;
-    list_free_t         freefun;
+#define PMR_MAGIC 0x7e5a17b0
+struct pm_result_struct {
+    int                 pmr_magic;
+    int                 pmr_count;
+    int                 pmr_size;       /* slots in pmr_nodes */
+    struct pm_node_result *pmr_nodes;
+    char *              pmr_strs;       /* node names and error causes */
+    int                 pmr_strlen;     /* bytes used in pmr_strs */
+    int                 pmr_strsize;    /* size of pmr_strs */
 };
 
 #define PMI_MAGIC 0x41a452b5
 struct pm_node_iterator_struct {
     int                 pmi_magic;
-    struct list_struct *pmi_nodes;
-    struct list_struct *pmi_pos;
+    pm_result_t         pmi_nodes;
+    int                 pmi_pos;
 };
 
-static pm_err_t _list_add(struct list_struct **head, char *s,
-                                list_free_t freefun);
-static void     _list_free(struct list_struct **head);
-static int      _list_search(struct list_struct *head, char *s);
+#define PMQ_MAGIC 0x5e9e5700
+#define PMQ_TAGLEN 16
+struct pm_request_struct {
+    int                 pmq_magic;
+    char                pmq_tag[PMQ_TAGLEN]; /* tag if pipelined, else "" */
+    int                 pmq_done;       /* final response line received */
+    pm_err_t            pmq_err;        /* result code, once done */
+    pm_result_t         pmq_result;     /* per-node results so far */
+    int                 pmq_internal;   /* JSON toggle, freed when done */
+    int                 pmq_json;       /* response is in JSON */
+    struct pm_request_struct *pmq_next;
+};
 
-static int      _strncmpend(char *s1, char *s2, int len);
-static char *   _strndup(char *s, int len);
 static void     _parse_hostport(char *s, char *host, char *port);
 static pm_err_t _connect_to_server_tcp(pm_handle_t pmh,
                                 char *server, int family);
-static pm_err_t _parse_response(char *buf, int len,
-                                struct list_struct **respp);
-static pm_err_t _server_recv_response(pm_handle_t pmh,
-                                struct list_struct **respp);
-static pm_err_t _server_send_command(pm_handle_t pmh, char *cmd, char *arg);
+static pm_err_t _result_create(pm_result_t *resultp);
+static int      _result_addstr(pm_result_t pmr, char *s, int len);
+static pm_err_t _result_add(pm_result_t pmr, char *node, int nodelen,
+                                char *state, int statelen, char *errstr);
+static char *   _json_member(char *obj, char *key);
+static int      _json_strlen(char *str);
+static pm_err_t _server_retcode(int code);
+static pm_err_t _server_recv_info(pm_request_t req, int code, char *text);
+static pm_err_t _server_recv_line(pm_handle_t pmh, char *line);
+static pm_err_t _server_recv_response(pm_handle_t pmh, int flags);
+static pm_err_t _server_send(pm_handle_t pmh, char *buf, int len);
+static pm_err_t _server_send_command(pm_handle_t pmh, char *tag,
+                                char *cmd, char *arg);
+static void     _server_queue(pm_handle_t pmh, pm_request_t req);
+static pm_err_t _server_toggle_json(pm_handle_t pmh);
+static pm_err_t _server_submit(pm_handle_t pmh, char *cmd, char *arg,
+                                int json, pm_request_t *reqp);
+static pm_err_t _server_wait(pm_handle_t pmh, pm_request_t req);
+static void     _server_release(pm_handle_t pmh, pm_request_t req);
+static pm_err_t _server_run(pm_handle_t pmh, char *cmd, char *arg,
+                                int query, int json, pm_request_t *reqp);
 static pm_err_t _server_command(pm_handle_t pmh, char *cmd, char *arg,
-                                struct list_struct **respp);
-
-
-/* Add [s] to the list referenced by [head], registering [freefun] to
- * be called on [s] when the list is freed.
- */
-static pm_err_t
-_list_add(struct list_struct **head, char *s, list_free_t freefun)
-{
-    struct list_struct *new;
-
-    if (!(new = malloc(sizeof(struct list_struct))))
-        return PM_ENOMEM;
-    new->data = s;
-    new->next = *head;
-    new->freefun = freefun;
-    *head = new;
-    return PM_ESUCCESS;
-}
-
-/* Free the list referred to by [head].
- */
-static void
-_list_free(struct list_struct **head)
-{
-    struct list_struct *lp, *tmp;
-
-    for (lp = *head; lp != NULL; lp = tmp) {
-        tmp = lp->next;
-        if (lp->freefun)
-            lp->freefun(lp->data);
-        free(lp);
-    }
-    *head = NULL;
-}
-
-/* Scan the list referenced by [head] looking for an element containing
- * exactly the string [s], returning true if found.
- */
-static int
-_list_search(struct list_struct *head, char *s)
-{
-    struct list_struct *lp;
-
-    for (lp = head; lp != NULL; lp = lp->next)
-        if (strcmp(lp->data, s) == 0)
-            return 1;
-    return 0;
-}
-
-/* Test if [s2] is a terminating substring of [s1].
- */
-static int
-_strncmpend(char *s1, char *s2, int len)
-{
-    return strncmp(s1 + len - strlen(s2), s2, strlen(s2));
-}
-
-/* Duplicate string [s] of length [len].
- * Result will be NULL terminated.  [s] doesn't have to be.
- */
-static char *
-_strndup(char *s, int len)
-{
-    char *c;
+                                int query, pm_result_t *resultp);
+static void     _handle_disconnect(pm_handle_t pmh, pm_err_t err);
+static pm_err_t _handle_connect(pm_handle_t pmh);
 
-    if ((c = (char *)malloc(len + 1))) {
-        memcpy(c, s, len);
-        c[len] = '\0';
-    }
-    return c;
-}
 
 static void
 _parse_hostport(char *s, char *host, char *port)
@@ -176,7 +182,9 @@ _parse_hostport(char *s, char *host, char *port)
 }
 
 /* Establish connection to powermand [server].
- * Connection state is returned in the handle.
+ * Connection state is returned in the handle.  A persistent connection
+ * gets TCP keepalives so a server that has gone away is noticed even
+ * while the connection is idle.
  */
 static pm_err_t
 _connect_to_server_tcp(pm_handle_t pmh, char *server, int family)
@@ -184,6 +192,7 @@ _connect_to_server_tcp(pm_handle_t pmh, char *server, int family)
     struct addrinfo hints, *res, *r;
     pm_err_t err = PM_ECONNECT;
     char host[MAXHOSTNAMELEN], port[MAXPORTNAMELEN];
+    int on = 1;
 
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = family;
@@ -199,226 +208,716 @@ _connect_to_server_tcp(pm_handle_t pmh, char *server, int family)
             close(pmh->pmh_fd);
             continue;
         }
+        if ((pmh->pmh_flags & PM_CONN_PERSIST))
+            (void)setsockopt(pmh->pmh_fd, SOL_SOCKET, SO_KEEPALIVE,
+                             &on, sizeof(on));
         err = PM_ESUCCESS;
         break;
     }
     freeaddrinfo(res);
+    if (err != PM_ESUCCESS)
+        pmh->pmh_fd = -1;
     return err;
 }
 
-/* Parse a server response stored in [buf] of length [len] into
- * an array of lines stored in [respp] which caller must free.
+/* Create an empty result.
  */
 static pm_err_t
-_parse_response(char *buf, int len, struct list_struct **respp)
+_result_create(pm_result_t *resultp)
 {
-    int i, l = strlen(CP_EOL);
-    char *p, *cpy;
-    struct list_struct *resp = NULL;
-    pm_err_t err = PM_ESUCCESS;
+    pm_result_t pmr;
 
-    p = buf;
-    for (i = 0; i < len - l; i++) {
-        if (strncmp(&buf[i], CP_EOL, l) != 0)
-            continue;
-        if ((cpy = _strndup(p, &buf[i] - p + l)) == NULL) {
-            err = PM_ENOMEM;
-            break;
-        }
-        if ((err = _list_add(&resp, cpy, (list_free_t)free)) != PM_ESUCCESS)
-            break;
-        p = &buf[i + l];
+    if (!(pmr = malloc(sizeof(struct pm_result_struct))))
+        return PM_ENOMEM;
+    memset(pmr, 0, sizeof(struct pm_result_struct));
+    pmr->pmr_magic = PMR_MAGIC;
+    *resultp = pmr;
+    return PM_ESUCCESS;
+}
+
+/* Copy [len] bytes of [s] to the string buffer of result [pmr], expanding
+ * the escapes in a JSON string, and NUL terminate it.
+ * Return its offset, or -1 if out of memory.
+ */
+static int
+_result_addstr(pm_result_t pmr, char *s, int len)
+{
+    int off = pmr->pmr_strlen;
+    unsigned int u;
+    char *p, *d;
+
+    if (pmr->pmr_strsize - pmr->pmr_strlen < len + 1) {
+        int size = pmr->pmr_strsize ? pmr->pmr_strsize : CP_LINEMAX;
+        char *strs;
+
+        while (size - pmr->pmr_strlen < len + 1)
+            size *= 2;
+        strs = pmr->pmr_strs ? realloc(pmr->pmr_strs, size) : malloc(size);
+        if (strs == NULL)
+            return -1;
+        pmr->pmr_strs = strs;
+        pmr->pmr_strsize = size;
+    }
+    d = pmr->pmr_strs + off;
+    for (p = s; p < s + len; p++) {
+        if (*p == '\\' && p + 1 < s + len) {
+            if (p[1] == 'u' && p + 5 < s + len
+                            && sscanf(p + 2, "%4x", &u) == 1) {
+                *d++ = u;
+                p += 5;
+            } else
+                *d++ = *++p;
+        } else
+            *d++ = *p;
     }
-    if (err == PM_ESUCCESS && respp != NULL)
-        *respp = resp;
+    *d++ = '\0';
+    pmr->pmr_strlen = d - pmr->pmr_strs;
+    return off;
+}
+
+/* Add a node to result [pmr].  [errstr] is a NUL terminated JSON string
+ * body or NULL.
+ */
+static pm_err_t
+_result_add(pm_result_t pmr, char *node, int nodelen,
+            char *state, int statelen, char *errstr)
+{
+    struct pm_node_result *r;
+
+    if (pmr->pmr_count == pmr->pmr_size) {
+        int size = pmr->pmr_size ? pmr->pmr_size * 2 : 64;
+
+        r = pmr->pmr_nodes ? realloc(pmr->pmr_nodes, size * sizeof(*r))
+                           : malloc(size * sizeof(*r));
+        if (r == NULL)
+            return PM_ENOMEM;
+        pmr->pmr_nodes = r;
+        pmr->pmr_size = size;
+    }
+    r = &pmr->pmr_nodes[pmr->pmr_count];
+    if ((r->node = _result_addstr(pmr, node, nodelen)) < 0)
+        return PM_ENOMEM;
+    r->errstr = -1;
+    if (errstr && (r->errstr = _result_addstr(pmr, errstr,
+                                        _json_strlen(errstr))) < 0)
+        return PM_ENOMEM;
+    if (statelen == 2 && strncmp(state, "on", 2) == 0)
+        r->state = PM_ON;
+    else if (statelen == 3 && strncmp(state, "off", 3) == 0)
+        r->state = PM_OFF;
     else
-        _list_free(&resp);
-    return err;
+        r->state = PM_UNKNOWN;
+    r->err = PM_ESUCCESS;
+    pmr->pmr_count++;
+    return PM_ESUCCESS;
+}
+
+/* Find the string value of member [key] in the JSON object [obj] (from a
+ * 309 line) and return a pointer to its first character, or NULL if the
+ * member is missing or null.  The server only sends flat objects, and
+ * only escapes quote, backslash and non-printable characters (as \u00XX).
+ */
+static char *
+_json_member(char *obj, char *key)
+{
+    char pat[64], *p;
+
+    snprintf(pat, sizeof(pat), "\"%s\":\"", key);
+    if (!(p = strstr(obj, pat)))
+        return NULL;
+    return p + strlen(pat);
+}
+
+/* Return the length of the JSON string body [str], up to the closing quote.
+ */
+static int
+_json_strlen(char *str)
+{
+    char *p;
+
+    for (p = str; *p && *p != '"'; p++)
+        if (*p == '\\' && p[1])
+            p++;
+    return p - str;
 }
 
-/* Scan response from server for return code.
+/* Convert the code on the final line of a response to a result.
  */
 static pm_err_t
-_server_retcode(struct list_struct *resp)
-{
-    int code;
-    pm_err_t err = PM_ESERVERPARSE;
-
-    /* N.B. there will only be one 1xx or 2xx code in a response */
-    while (resp != NULL) {
-        if (sscanf(resp->data, "%d ", &code) == 1) {
-            switch (code) {
-                case 1:     /* hello */
-                case 101:   /* goodbye */
-                case 102:   /* command completed successfully */
-                case 103:   /* query complete */
-                case 104:   /* telemetry on|off */
-                case 105:   /* hostrange expansion on|off */
-                    err = PM_ESUCCESS;
-                    break;
-                case PM_EUNKNOWN:
-                case PM_EPARSE:
-                case PM_ETOOLONG:
-                case PM_EINTERNAL:
-                case PM_EHOSTLIST:
-                case PM_EINPROGRESS:
-                case PM_ENOSUCHNODES:
-                case PM_ECOMMAND:
-                case PM_EQUERY:
-                case PM_EUNIMPL:
-                    err = code;
-                    break;
-                default:    /* 3xx informational (ignore) */
-                    break;
-            }
-        }
-        resp = resp->next;
+_server_retcode(int code)
+{
+    switch (code) {
+        case 1:     /* hello */
+            return PM_ESUCCESS;
+        case PM_EUNKNOWN:
+        case PM_EPARSE:
+        case PM_ETOOLONG:
+        case PM_EINTERNAL:
+        case PM_EHOSTLIST:
+        case PM_EINPROGRESS:
+        case PM_ENOSUCHNODES:
+        case PM_ECOMMAND:
+        case PM_EQUERY:
+        case PM_EUNIMPL:
+            return code;
     }
-    return err;
+    if (CP_IS_SUCCESS(code))
+        return PM_ESUCCESS;
+    return PM_ESERVERPARSE;
 }
 
-/* Read response from server handle [pmh] and store it in
- * [resp], an array of lines.  Caller must free [resp].
+/* Add the node in informational line [text] with [code] to the result of
+ * request [req].  Lines without a node are ignored.
  */
 static pm_err_t
-_server_recv_response(pm_handle_t pmh, struct list_struct **respp)
+_server_recv_info(pm_request_t req, int code, char *text)
 {
-    int buflen = 0, count = 0, n;
-    char *buf = NULL;
-    pm_err_t err = PM_ESUCCESS;
-    struct list_struct *resp;
+    char *node, *state, *errstr, *p;
 
-    do {
-        if (buflen - count == 0) {
-            buflen += CP_LINEMAX;
-            buf = buf ? realloc(buf, buflen) : malloc(buflen);
-            if (buf == NULL) {
-                err = PM_ENOMEM;
+    switch (code) {
+        case 303:                       /* node: state */
+            if (!(p = strrchr(text, ':')) || p[1] != ' ')
+                return PM_ESERVERPARSE;
+            return _result_add(req->pmq_result, text, p - text,
+                               p + 2, strlen(p + 2), NULL);
+        case 307:                       /* node */
+            return _result_add(req->pmq_result, text, strlen(text),
+                               "", 0, NULL);
+        case 309:                       /* JSON object */
+            if (!(node = _json_member(text, "node")))
+                return PM_ESUCCESS;     /* e.g. a device */
+            state = _json_member(text, "state");
+            errstr = _json_member(text, "error");
+            return _result_add(req->pmq_result, node, _json_strlen(node),
+                               state ? state : "",
+                               state ? _json_strlen(state) : 0, errstr);
+    }
+    return PM_ESUCCESS;
+}
+
+/* Handle a response line, NUL terminated in place of its CP_EOL.
+ * A line with a 1xx or 2xx code (or the 001 greeting) completes the
+ * request it belongs to.
+ */
+static pm_err_t
+_server_recv_line(pm_handle_t pmh, char *line)
+{
+    int plen = strlen(CP_PROMPT);
+    pm_request_t req;
+    int code, i;
+    char *p;
+
+    /* prompts are not followed by a line break, so they precede the
+     * next line rather than standing alone */
+    while (strncmp(line, CP_PROMPT, plen) == 0)
+        line += plen;
+    if (pmh->pmh_pipeline) {
+        if (!(p = strchr(line, ' ')))
+            return PM_ESERVERPARSE;
+        *p++ = '\0';
+        for (req = pmh->pmh_reqs; req != NULL; req = req->pmq_next)
+            if (!req->pmq_done && strcmp(req->pmq_tag, line) == 0)
                 break;
-            }
-        }
-        n = read(pmh->pmh_fd, buf + count, buflen - count);
-        if (n == 0) {
-            err = PM_ESERVEREOF;
-            break;
+        line = p;
+    } else {
+        for (req = pmh->pmh_reqs; req != NULL; req = req->pmq_next)
+            if (!req->pmq_done)
+                break;
+    }
+    if (req == NULL)
+        return PM_ESERVERPARSE;         /* nobody asked for this */
+
+    /* every line starts with a three digit code */
+    for (code = 0, i = 0; i < 3; i++) {
+        if (line[i] < '0' || line[i] > '9')
+            return PM_ESERVERPARSE;
+        code = code * 10 + line[i] - '0';
+    }
+    if (code == 1 || CP_IS_ALLDONE(code)) {
+        pm_result_t pmr = req->pmq_result;
+
+        req->pmq_err = _server_retcode(code);
+        req->pmq_done = 1;
+        if (req->pmq_internal) {
+            _server_release(pmh, req);
+            return PM_ESUCCESS;
         }
-        if (n < 0) {
-            err = PM_ERRNOVALID;
+        /* JSON gives the nodes that failed; otherwise it can only be
+         * told that status queries got no state for some nodes */
+        for (i = 0; i < pmr->pmr_count; i++)
+            if (pmr->pmr_nodes[i].errstr >= 0 || (!req->pmq_json
+                        && pmr->pmr_nodes[i].state == PM_UNKNOWN))
+                pmr->pmr_nodes[i].err = req->pmq_err;
+        return PM_ESUCCESS;
+    }
+    if (line[3] != ' ')
+        return PM_ESERVERPARSE;
+    return _server_recv_info(req, code, line + 4);
+}
+
+/* Read what the server has sent on handle [pmh], and pass each complete
+ * line to _server_recv_line().  With [flags] of MSG_DONTWAIT, return
+ * success without waiting if there is nothing to read.
+ */
+static pm_err_t
+_server_recv_response(pm_handle_t pmh, int flags)
+{
+    int l = strlen(CP_EOL), n;
+    pm_err_t err = PM_ESUCCESS;
+    char *p, *eol, *end;
+
+    if (pmh->pmh_buflen - pmh->pmh_count == 0) {
+        int len = pmh->pmh_buflen + CP_LINEMAX;
+        char *buf;
+
+        buf = pmh->pmh_buf ? realloc(pmh->pmh_buf, len) : malloc(len);
+        if (buf == NULL)
+            return PM_ENOMEM;
+        pmh->pmh_buf = buf;
+        pmh->pmh_buflen = len;
+    }
+    n = recv(pmh->pmh_fd, pmh->pmh_buf + pmh->pmh_count,
+             pmh->pmh_buflen - pmh->pmh_count, flags);
+    if (n == 0)
+        return PM_ESERVEREOF;
+    if (n < 0) {
+        if (errno == EINTR || ((flags & MSG_DONTWAIT)
+                        && (errno == EAGAIN || errno == EWOULDBLOCK)))
+            return PM_ESUCCESS;
+        return PM_ERRNOVALID;
+    }
+    pmh->pmh_count += n;
+
+    /* only new data is searched for line breaks */
+    p = pmh->pmh_buf;
+    end = pmh->pmh_buf + pmh->pmh_count;
+    while ((eol = memchr(pmh->pmh_buf + pmh->pmh_scan, CP_EOL[l - 1],
+                         end - (pmh->pmh_buf + pmh->pmh_scan)))) {
+        pmh->pmh_scan = eol + 1 - pmh->pmh_buf;
+        if (eol - p < l - 1 || strncmp(eol - (l - 1), CP_EOL, l) != 0)
+            continue;
+        *(eol - (l - 1)) = '\0';
+        if ((err = _server_recv_line(pmh, p)) != PM_ESUCCESS)
             break;
-        }
-        count += n;
-    } while (_strncmpend(buf, CP_PROMPT, count) != 0);
-
-    if (err == PM_ESUCCESS) {
-        err = _parse_response(buf, count, &resp);
-        if (err == PM_ESUCCESS) {
-            err = _server_retcode(resp);
-            if (err == PM_ESUCCESS && respp != NULL)
-                *respp = resp;
-            else
-                _list_free(&resp);
-        }
+        p = eol + 1;
     }
-    if (buf != NULL)
-        free(buf);
+    pmh->pmh_count -= p - pmh->pmh_buf;
+    pmh->pmh_scan = err == PM_ESUCCESS ? pmh->pmh_count : 0;
+    memmove(pmh->pmh_buf, p, pmh->pmh_count);
     return err;
 }
 
-/* Send command [cmd] with argument [arg] to server handle [pmh].
- * [cmd] is treated as a printf format string with [arg] as the
- * first printf argument (can be NULL).
+/* Send [len] bytes of [buf] to server handle [pmh].
+ * A server that has gone away must not kill the caller with SIGPIPE.
  */
 static pm_err_t
-_server_send_command(pm_handle_t pmh, char *cmd, char *arg)
+_server_send(pm_handle_t pmh, char *buf, int len)
 {
-    char buf[CP_LINEMAX];
-    int count, len, n;
-    pm_err_t err = PM_ESUCCESS;
+    int count = 0, n;
 
-    snprintf(buf, sizeof(buf), cmd, arg);
-    snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), CP_EOL);
-    count = 0;
-    len = strlen(buf);
     while (count < len) {
-        n = write(pmh->pmh_fd, buf + count, len - count);
+        n = send(pmh->pmh_fd, buf + count, len - count, MSG_NOSIGNAL);
         if (n < 0) {
-            err = PM_ERRNOVALID;
-            break;
+            if (errno == EINTR)
+                continue;
+            return PM_ERRNOVALID;
         }
         count += n;
     }
-    return err;
+    return PM_ESUCCESS;
 }
 
-/* Send command [cmd] with argument [arg] to server handle [pmh].
- * If [respp] is non-NULL, return list of response lines which
- * the caller must free.
+/* Send command [cmd] with argument [arg] to server handle [pmh],
+ * prefixed with [tag] if it is not empty.
+ * [cmd] is treated as a printf format string with [arg] as the
+ * first printf argument (can be NULL).  The caller has checked that
+ * the command fits in CP_LINEMAX.
+ */
+static pm_err_t
+_server_send_command(pm_handle_t pmh, char *tag, char *cmd, char *arg)
+{
+    char buf[CP_TAGMAX + 1 + CP_LINEMAX + sizeof(CP_EOL)];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%s%s", tag, *tag ? " " : "");
+    len += snprintf(buf + len, sizeof(buf) - len, cmd, arg);
+    len += snprintf(buf + len, sizeof(buf) - len, CP_EOL);
+    return _server_send(pmh, buf, len);
+}
+
+/* Create a request with an empty result.
  */
 static pm_err_t
-_server_command(pm_handle_t pmh, char *cmd, char *arg, struct list_struct **respp)
+_request_create(pm_request_t *reqp)
 {
+    pm_request_t req;
+
+    if (!(req = malloc(sizeof(struct pm_request_struct))))
+        return PM_ENOMEM;
+    memset(req, 0, sizeof(struct pm_request_struct));
+    if (_result_create(&req->pmq_result) != PM_ESUCCESS) {
+        free(req);
+        return PM_ENOMEM;
+    }
+    req->pmq_magic = PMQ_MAGIC;
+    *reqp = req;
+    return PM_ESUCCESS;
+}
+
+/* Add request [req] to the end of the list on handle [pmh].
+ */
+static void
+_server_queue(pm_handle_t pmh, pm_request_t req)
+{
+    pm_request_t *rp;
+
+    for (rp = &pmh->pmh_reqs; *rp != NULL; rp = &(*rp)->pmq_next)
+        ;
+    *rp = req;
+}
+
+/* Switch JSON results on or off for the requests that follow on server
+ * handle [pmh].  The server applies the mode in effect when a command is
+ * issued to its reply, so this does not affect requests in progress.
+ * The reply to the toggle is consumed by _server_recv_line().
+ */
+static pm_err_t
+_server_toggle_json(pm_handle_t pmh)
+{
+    pm_request_t req;
     pm_err_t err;
 
-    if ((err = _server_send_command(pmh, cmd, arg)) != PM_ESUCCESS)
+    if ((err = _request_create(&req)) != PM_ESUCCESS)
         return err;
-    if ((err = _server_recv_response(pmh, respp)) != PM_ESUCCESS)
+    req->pmq_internal = 1;
+    if (pmh->pmh_pipeline)
+        snprintf(req->pmq_tag, sizeof(req->pmq_tag), "%d",
+                 ++pmh->pmh_tagseq);
+    _server_queue(pmh, req);
+    if ((err = _server_send_command(pmh, req->pmq_tag, CP_JSON, NULL))
+                                                        != PM_ESUCCESS) {
+        _server_release(pmh, req);
+        _handle_disconnect(pmh, err);
         return err;
+    }
+    pmh->pmh_json_on = !pmh->pmh_json_on;
     return PM_ESUCCESS;
 }
 
-pm_err_t
-pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags)
+/* Send command [cmd] with argument [arg] to server handle [pmh] and
+ * return a request in [reqp] to collect the response.  If [json] is set
+ * and the server supports it, the response is in JSON, which is several
+ * times larger but is the only way to get per-node results and errors
+ * for power control commands.
+ * A persistent handle that has lost its connection connects again first.
+ */
+static pm_err_t
+_server_submit(pm_handle_t pmh, char *cmd, char *arg, int json,
+               pm_request_t *reqp)
 {
-    pm_handle_t pmh = NULL;
+    pm_request_t req;
+    int pending = 0;
     pm_err_t err;
 
-    if (pmhp == NULL)
-        return PM_EBADARG;
-    if ((pmh = (pm_handle_t)malloc(sizeof(struct pm_handle_struct))) == NULL)
-        return PM_ENOMEM;
-    pmh->pmh_magic = PMH_MAGIC;
-
-    if ((err = _connect_to_server_tcp(pmh, server, (flags & PM_CONN_INET6)
-                                ? PF_INET6 : PF_UNSPEC)) != PM_ESUCCESS) {
-        (void)close(pmh->pmh_fd);
-        free(pmh);
-        return err;
+    /* the server would refuse it, and a truncated line could be taken
+     * for another command or run into the next one, so do not send it */
+    if (snprintf(NULL, 0, cmd, arg) >= CP_LINEMAX)
+        return PM_ETOOLONG;
+    if (pmh->pmh_fd < 0) {
+        if (!(pmh->pmh_flags & PM_CONN_PERSIST))
+            return PM_ESERVEREOF;
+        if ((err = _handle_connect(pmh)) != PM_ESUCCESS)
+            return err;
     }
-    if ((err = _server_recv_response(pmh, NULL)) != PM_ESUCCESS) {
-        (void)close(pmh->pmh_fd);
-        free(pmh);
+    for (req = pmh->pmh_reqs; req != NULL; req = req->pmq_next)
+        if (!req->pmq_done && !req->pmq_internal)
+            pending++;
+    if (pending >= (pmh->pmh_pipeline ? CP_PIPELINE_MAX : 1))
+        return PM_EINPROGRESS;
+    if ((json && pmh->pmh_json) != pmh->pmh_json_on
+                    && (err = _server_toggle_json(pmh)) != PM_ESUCCESS)
+        return err;
+    if ((err = _request_create(&req)) != PM_ESUCCESS)
         return err;
+    req->pmq_json = pmh->pmh_json_on;
+    if (pmh->pmh_pipeline)
+        snprintf(req->pmq_tag, sizeof(req->pmq_tag), "%d",
+                 ++pmh->pmh_tagseq);
+    _server_queue(pmh, req);
+    if ((err = _server_send_command(pmh, req->pmq_tag, cmd, arg))
+                                                        != PM_ESUCCESS) {
+        _server_release(pmh, req);
+        _handle_disconnect(pmh, err);
+        return err;
+    }
+    *reqp = req;
+    return PM_ESUCCESS;
+}
+
+/* Read from server handle [pmh] until request [req] is done, and return
+ * its result code.  Only one thread reads at a time, without the lock
+ * held while it sleeps in poll(); any others wait for it to finish.
+ * If reading fails, the connection is dropped and [req] fails with it.
+ */
+static pm_err_t
+_server_wait(pm_handle_t pmh, pm_request_t req)
+{
+    struct pollfd pfd;
+    pm_err_t err;
+    int n;
+
+    while (!req->pmq_done) {
+        if (pmh->pmh_reading) {
+            pthread_cond_wait(&pmh->pmh_cond, &pmh->pmh_lock);
+            continue;
+        }
+        pmh->pmh_reading = 1;
+        pfd.fd = pmh->pmh_fd;
+        pfd.events = POLLIN;
+        pthread_mutex_unlock(&pmh->pmh_lock);
+        n = poll(&pfd, 1, PM_WAIT_POLL_MS);
+        pthread_mutex_lock(&pmh->pmh_lock);
+        pmh->pmh_reading = 0;
+
+        err = PM_ESUCCESS;
+        if (n < 0 && errno != EINTR)
+            err = PM_ERRNOVALID;
+        else if (n > 0 && pmh->pmh_fd == pfd.fd)
+            err = _server_recv_response(pmh, MSG_DONTWAIT);
+        if (err != PM_ESUCCESS)
+            _handle_disconnect(pmh, err);
+        pthread_cond_broadcast(&pmh->pmh_cond);
+    }
+    return req->pmq_err;
+}
+
+/* Remove request [req] from handle [pmh] and free it.
+ */
+static void
+_server_release(pm_handle_t pmh, pm_request_t req)
+{
+    pm_request_t *rp;
+
+    for (rp = &pmh->pmh_reqs; *rp != NULL; rp = &(*rp)->pmq_next) {
+        if (*rp == req) {
+            *rp = req->pmq_next;
+            break;
+        }
+    }
+    pm_result_destroy(req->pmq_result);
+    req->pmq_magic = 0;
+    free(req);
+}
+
+/* Submit command [cmd] with argument [arg] to server handle [pmh] and
+ * wait for it.  The request is returned in [reqp] (NULL if it could not
+ * be submitted) for the caller to release.  If the connection of a
+ * persistent handle was lost and [query] is set, the command has no
+ * effect on the nodes, so it is sent once more on a new connection.
+ * [json] is as for _server_submit().
+ */
+static pm_err_t
+_server_run(pm_handle_t pmh, char *cmd, char *arg, int query, int json,
+            pm_request_t *reqp)
+{
+    pm_request_t req = NULL;
+    pm_err_t err;
+    int tries = 0;
+
+    do {
+        if (req != NULL)
+            _server_release(pmh, req);
+        req = NULL;
+        if ((err = _server_submit(pmh, cmd, arg, json, &req)) == PM_ESUCCESS)
+            err = _server_wait(pmh, req);
+    } while (query && (pmh->pmh_flags & PM_CONN_PERSIST) && tries++ == 0
+            && (err == PM_ESERVEREOF || err == PM_ERRNOVALID));
+    *reqp = req;
+    return err;
+}
+
+/* Send command [cmd] with argument [arg] to server handle [pmh].
+ * If [resultp] is non-NULL, return the nodes in the response, which
+ * the caller must free.  [query] is as for _server_run().
+ */
+static pm_err_t
+_server_command(pm_handle_t pmh, char *cmd, char *arg, int query,
+                pm_result_t *resultp)
+{
+    pm_request_t req;
+    pm_err_t err;
+
+    err = _server_run(pmh, cmd, arg, query, 0, &req);
+    if (err == PM_ESUCCESS && resultp != NULL) {
+        *resultp = req->pmq_result;
+        req->pmq_result = NULL;
+    }
+    if (req != NULL)
+        _server_release(pmh, req);
+    return err;
+}
+
+/* Drop the connection of handle [pmh] after error [err], which becomes
+ * the result of every request still in progress on it.
+ */
+static void
+_handle_disconnect(pm_handle_t pmh, pm_err_t err)
+{
+    pm_request_t req, next;
+
+    for (req = pmh->pmh_reqs; req != NULL; req = next) {
+        next = req->pmq_next;
+        if (req->pmq_internal)
+            _server_release(pmh, req);
+        else if (!req->pmq_done) {
+            req->pmq_err = err;
+            req->pmq_done = 1;
+        }
     }
-    if ((err = _server_command(pmh, CP_EXPRANGE, NULL, NULL)) != PM_ESUCCESS) {
+    if (pmh->pmh_fd >= 0)
         (void)close(pmh->pmh_fd);
-        free(pmh);
+    pmh->pmh_fd = -1;
+    pmh->pmh_count = 0;
+    pmh->pmh_scan = 0;
+    pmh->pmh_json = 0;
+    pmh->pmh_json_on = 0;
+    pmh->pmh_pipeline = 0;
+    pthread_cond_broadcast(&pmh->pmh_cond);
+}
+
+/* Connect handle [pmh] to its server, wait for the greeting, and ask for
+ * the reply formats this library understands.  JSON results and
+ * pipelining are optional, so an older server that does not know them is
+ * still usable (one request at a time, results parsed from 303 lines).
+ * JSON is switched on and off again to find out whether the server has
+ * it: it is only asked for where needed (see _server_submit()), since
+ * status and node lists are much smaller as expanded 303/307 lines.
+ * The setup commands are sent together, since the server answers
+ * in order even when not pipelined, so setup costs one round trip.
+ */
+static pm_err_t
+_handle_connect(pm_handle_t pmh)
+{
+    char *setup[] = { CP_EXPRANGE, CP_JSON, CP_JSON, CP_PIPELINE };
+    int nsetup = sizeof(setup) / sizeof(setup[0]);
+    pm_request_t hello, req[4];
+    char buf[CP_LINEMAX];
+    pm_err_t err;
+    int i, j;
+
+    if ((err = _connect_to_server_tcp(pmh, pmh->pmh_server,
+                                (pmh->pmh_flags & PM_CONN_INET6)
+                                ? PF_INET6 : PF_UNSPEC)) != PM_ESUCCESS)
+        return err;
+    if ((err = _request_create(&hello)) != PM_ESUCCESS) {
+        _handle_disconnect(pmh, err);
         return err;
     }
+    _server_queue(pmh, hello);
+    buf[0] = '\0';
+    for (i = 0; i < nsetup; i++) {
+        if ((err = _request_create(&req[i])) != PM_ESUCCESS)
+            break;
+        _server_queue(pmh, req[i]);
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+                 "%s" CP_EOL, setup[i]);
+    }
     if (err == PM_ESUCCESS)
-        *pmhp = pmh;
-    else
-        free(pmh);
+        err = _server_send(pmh, buf, strlen(buf));
+    if (err != PM_ESUCCESS) {
+        _handle_disconnect(pmh, err);
+        goto done;
+    }
+    (void)_server_wait(pmh, req[nsetup - 1]);
+
+    if ((err = hello->pmq_err) == PM_ESUCCESS)
+        err = req[0]->pmq_err;
+    for (j = 1; j < 3; j++)
+        if (err == PM_ESUCCESS && req[j]->pmq_err != PM_ESUCCESS
+                               && req[j]->pmq_err != PM_EUNKNOWN)
+            err = req[j]->pmq_err;
+    if (err == PM_ESUCCESS && req[1]->pmq_err == PM_ESUCCESS
+                           && req[2]->pmq_err == PM_ESUCCESS)
+        pmh->pmh_json = 1;
+    if (err == PM_ESUCCESS && req[3]->pmq_err == PM_ESUCCESS)
+        pmh->pmh_pipeline = 1;
+    else if (err == PM_ESUCCESS && req[3]->pmq_err != PM_EUNKNOWN)
+        err = req[3]->pmq_err;
+done:
+    _server_release(pmh, hello);
+    while (i-- > 0)
+        _server_release(pmh, req[i]);
+    if (err != PM_ESUCCESS)
+        _handle_disconnect(pmh, err);
     return err;
 }
 
+/* Free handle [pmh] and any requests still attached to it.
+ */
+static void
+_handle_destroy(pm_handle_t pmh)
+{
+    while (pmh->pmh_reqs != NULL)
+        _server_release(pmh, pmh->pmh_reqs);
+    if (pmh->pmh_buf)
+        free(pmh->pmh_buf);
+    if (pmh->pmh_server)
+        free(pmh->pmh_server);
+    pthread_cond_destroy(&pmh->pmh_cond);
+    pthread_mutex_destroy(&pmh->pmh_lock);
+    pmh->pmh_magic = 0;
+    free(pmh);
+}
+
+/* Create an unconnected handle for [server] with pm_connect() [flags].
+ */
 static pm_err_t
-_node_iterator_create(pm_node_iterator_t *pmip)
+_handle_create(char *server, int flags, pm_handle_t *pmhp)
 {
-    pm_node_iterator_t pmi;
+    pm_handle_t pmh;
 
-    if (!(pmi = malloc(sizeof(struct pm_node_iterator_struct))))
+    if ((pmh = (pm_handle_t)malloc(sizeof(struct pm_handle_struct))) == NULL)
         return PM_ENOMEM;
-    pmi->pmi_magic = PMI_MAGIC;
-    pmi->pmi_pos = pmi->pmi_nodes = NULL;
-    *pmip = pmi;
+    memset(pmh, 0, sizeof(struct pm_handle_struct));
+    if (server && !(pmh->pmh_server = strdup(server))) {
+        free(pmh);
+        return PM_ENOMEM;
+    }
+    pmh->pmh_magic = PMH_MAGIC;
+    pmh->pmh_fd = -1;
+    pmh->pmh_flags = flags;
+    pthread_mutex_init(&pmh->pmh_lock, NULL);
+    pthread_cond_init(&pmh->pmh_cond, NULL);
+    *pmhp = pmh;
+    return PM_ESUCCESS;
+}
+
+pm_err_t
+pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags)
+{
+    pm_handle_t pmh = NULL;
+    pm_err_t err;
+
+    if (pmhp == NULL)
+        return PM_EBADARG;
+
+    if ((err = _handle_create(server, flags, &pmh)) != PM_ESUCCESS)
+        return err;
+    pthread_mutex_lock(&pmh->pmh_lock);
+    err = _handle_connect(pmh);
+    pthread_mutex_unlock(&pmh->pmh_lock);
+    if (err != PM_ESUCCESS) {
+        _handle_destroy(pmh);
+        return err;
+    }
+    *pmhp = pmh;
     return PM_ESUCCESS;
 }
 
 void
 pm_node_iterator_destroy(pm_node_iterator_t pmi)
 {
-    _list_free(&pmi->pmi_nodes);
-    pmi->pmi_pos = NULL;
+    pm_result_destroy(pmi->pmi_nodes);
     pmi->pmi_magic = 0;
     free(pmi);
 }
@@ -427,68 +926,289 @@ pm_err_t
 pm_node_iterator_create(pm_handle_t pmh, pm_node_iterator_t *pmip)
 {
     pm_node_iterator_t pmi;
-    struct list_struct *lp, *resp;
-    char *cpy, node[CP_LINEMAX];
     pm_err_t err;
 
     if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
         return PM_EBADHAND;
-    if ((err = _node_iterator_create(&pmi)) != PM_ESUCCESS)
-        return err;
-    if ((err = _server_command(pmh, CP_NODES, NULL, &resp)) != PM_ESUCCESS) {
-        pm_node_iterator_destroy(pmi);
+    if (!(pmi = malloc(sizeof(struct pm_node_iterator_struct))))
+        return PM_ENOMEM;
+    pmi->pmi_magic = PMI_MAGIC;
+    pmi->pmi_pos = 0;
+    pthread_mutex_lock(&pmh->pmh_lock);
+    err = _server_command(pmh, CP_NODES, NULL, 1, &pmi->pmi_nodes);
+    pthread_mutex_unlock(&pmh->pmh_lock);
+    if (err != PM_ESUCCESS) {
+        free(pmi);
         return err;
     }
-    for (lp = resp; lp != NULL; lp = lp->next) {
-        if (sscanf(lp->data, CP_INFO_XNODES, node) == 1) {
-            if (!(cpy = strdup(node))) {
-                err = PM_ENOMEM;
-                break;
-            }
-            err = _list_add(&pmi->pmi_nodes, cpy, (list_free_t)free);
-            if (err != PM_ESUCCESS)
-                break;
-        }
-    }
-
-    if (err == PM_ESUCCESS && pmip != NULL) {
-        pm_node_iterator_reset(pmi);
+    if (pmip != NULL)
         *pmip = pmi;
-    } else
+    else
         pm_node_iterator_destroy(pmi);
-    _list_free(&resp);
-    return err;
+    return PM_ESUCCESS;
 }
 
 char *
 pm_node_next(pm_node_iterator_t pmi)
 {
-    struct list_struct *cur = pmi->pmi_pos;
-
-    if (!cur)
+    if (pmi->pmi_pos >= pm_result_count(pmi->pmi_nodes))
         return NULL;
-    pmi->pmi_pos = pmi->pmi_pos->next;
-
-    return cur->data;
+    return pm_result_node(pmi->pmi_nodes, pmi->pmi_pos++);
 }
 
 void
 pm_node_iterator_reset(pm_node_iterator_t pmi)
 {
-    pmi->pmi_pos = pmi->pmi_nodes;
+    pmi->pmi_pos = 0;
 }
 
 
 /* Disconnect from server handle [pmh] and free the handle.
+ * No other thread may be using the handle.
  */
 void
 pm_disconnect(pm_handle_t pmh)
 {
     if (pmh != NULL && pmh->pmh_magic == PMH_MAGIC) {
-        (void)_server_command(pmh, CP_QUIT, NULL, NULL); /* PM_ESERVEREOF */
-        (void)close(pmh->pmh_fd);
-        free(pmh);
+        pthread_mutex_lock(&pmh->pmh_lock);
+        if (pmh->pmh_fd >= 0) {
+            (void)_server_command(pmh, CP_QUIT, NULL, 0, NULL);
+            _handle_disconnect(pmh, PM_ESERVEREOF);
+        }
+        pthread_mutex_unlock(&pmh->pmh_lock);
+        _handle_destroy(pmh);
+    }
+}
+
+/* Translate operation [op] to a server command, or NULL if it is bad.
+ */
+static char *
+_op_command(pm_op_t op)
+{
+    switch (op) {
+        case PM_OP_STATUS:
+            return CP_STATUS;
+        case PM_OP_ON:
+            return CP_ON;
+        case PM_OP_OFF:
+            return CP_OFF;
+        case PM_OP_CYCLE:
+            return CP_CYCLE;
     }
+    return NULL;
+}
+
+/* Submit operation [op] on nodes [hosts] to server handle [pmh].
+ */
+pm_err_t
+pm_submit(pm_handle_t pmh, pm_op_t op, char *hosts, pm_request_t *reqp)
+{
+    char *cmd;
+    pm_err_t err;
+
+    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
+        return PM_EBADHAND;
+    if (hosts == NULL || reqp == NULL || !(cmd = _op_command(op)))
+        return PM_EBADARG;
+    pthread_mutex_lock(&pmh->pmh_lock);
+    err = _server_submit(pmh, cmd, hosts, op != PM_OP_STATUS, reqp);
+    pthread_mutex_unlock(&pmh->pmh_lock);
+    return err;
+}
+
+/* Return the file descriptor of server handle [pmh] for the caller's
+ * poll loop, or -1 if the handle is bad or not connected.  It changes
+ * when a persistent handle connects again.
+ */
+int
+pm_fd(pm_handle_t pmh)
+{
+    int fd;
+
+    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
+        return -1;
+    pthread_mutex_lock(&pmh->pmh_lock);
+    fd = pmh->pmh_fd;
+    pthread_mutex_unlock(&pmh->pmh_lock);
+    return fd;
+}
+
+/* Read whatever has arrived on server handle [pmh] without blocking,
+ * completing requests as their responses end.
+ */
+pm_err_t
+pm_poll(pm_handle_t pmh)
+{
+    pm_err_t err = PM_ESERVEREOF;
+
+    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
+        return PM_EBADHAND;
+    pthread_mutex_lock(&pmh->pmh_lock);
+    if (pmh->pmh_fd >= 0) {
+        err = _server_recv_response(pmh, MSG_DONTWAIT);
+        if (err != PM_ESUCCESS)
+            _handle_disconnect(pmh, err);
+        pthread_cond_broadcast(&pmh->pmh_cond);
+    }
+    pthread_mutex_unlock(&pmh->pmh_lock);
+    return err;
+}
+
+/* If request [req] on server handle [pmh] is done, free it and return its
+ * result code, and if [resultp] is non-NULL, its per-node results (even
+ * if the code is an error from the server).  Otherwise return PM_EAGAIN.
+ * [resultp] is set to NULL if no result is returned.
+ */
+pm_err_t
+pm_complete(pm_handle_t pmh, pm_request_t req, pm_result_t *resultp)
+{
+    pm_err_t err;
+
+    if (resultp != NULL)
+        *resultp = NULL;
+    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
+        return PM_EBADHAND;
+    if (req == NULL || req->pmq_magic != PMQ_MAGIC)
+        return PM_EBADARG;
+    pthread_mutex_lock(&pmh->pmh_lock);
+    if (!req->pmq_done) {
+        pthread_mutex_unlock(&pmh->pmh_lock);
+        return PM_EAGAIN;
+    }
+    err = req->pmq_err;
+    if (resultp != NULL) {
+        *resultp = req->pmq_result;
+        req->pmq_result = NULL;
+    }
+    _server_release(pmh, req);
+    pthread_mutex_unlock(&pmh->pmh_lock);
+    return err;
+}
+
+/* Helper for the pm_hosts_* functions.  Submit operation [op] on [hosts]
+ * and wait for it to complete.  The per-node results are returned even
+ * if the server reports an error, but not if the connection failed.
+ */
+static pm_err_t
+_hosts_op(pm_handle_t pmh, pm_op_t op, char *hosts, pm_result_t *resultp)
+{
+    pm_request_t req;
+    pm_err_t err;
+    char *cmd;
+
+    if (resultp != NULL)
+        *resultp = NULL;
+    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
+        return PM_EBADHAND;
+    if (hosts == NULL || !(cmd = _op_command(op)))
+        return PM_EBADARG;
+    pthread_mutex_lock(&pmh->pmh_lock);
+    err = _server_run(pmh, cmd, hosts, op == PM_OP_STATUS,
+                      op != PM_OP_STATUS, &req);
+    if (req != NULL) {
+        if (resultp != NULL && err != PM_ESERVEREOF
+                            && err != PM_ERRNOVALID && err != PM_ENOMEM) {
+            *resultp = req->pmq_result;
+            req->pmq_result = NULL;
+        }
+        _server_release(pmh, req);
+    }
+    pthread_mutex_unlock(&pmh->pmh_lock);
+    return err;
+}
+
+/* Query server [pmh] for the power status of the nodes in hostlist
+ * [hosts], returning a result for each in [resultp].
+ */
+pm_err_t
+pm_hosts_status(pm_handle_t pmh, char *hosts, pm_result_t *resultp)
+{
+    return _hosts_op(pmh, PM_OP_STATUS, hosts, resultp);
+}
+
+/* Tell server [pmh] to turn the nodes in hostlist [hosts] on.
+ */
+pm_err_t
+pm_hosts_on(pm_handle_t pmh, char *hosts, pm_result_t *resultp)
+{
+    return _hosts_op(pmh, PM_OP_ON, hosts, resultp);
+}
+
+/* Tell server [pmh] to turn the nodes in hostlist [hosts] off.
+ */
+pm_err_t
+pm_hosts_off(pm_handle_t pmh, char *hosts, pm_result_t *resultp)
+{
+    return _hosts_op(pmh, PM_OP_OFF, hosts, resultp);
+}
+
+/* Tell server [pmh] to cycle the nodes in hostlist [hosts].
+ */
+pm_err_t
+pm_hosts_cycle(pm_handle_t pmh, char *hosts, pm_result_t *resultp)
+{
+    return _hosts_op(pmh, PM_OP_CYCLE, hosts, resultp);
+}
+
+/* Accessors for the per-node results in [pmr].  [i] runs from zero to
+ * pm_result_count() - 1, in the order the server reported the nodes.
+ */
+int
+pm_result_count(pm_result_t pmr)
+{
+    if (pmr == NULL || pmr->pmr_magic != PMR_MAGIC)
+        return 0;
+    return pmr->pmr_count;
+}
+
+char *
+pm_result_node(pm_result_t pmr, int i)
+{
+    if (pmr == NULL || pmr->pmr_magic != PMR_MAGIC
+                    || i < 0 || i >= pmr->pmr_count)
+        return NULL;
+    return pmr->pmr_strs + pmr->pmr_nodes[i].node;
+}
+
+pm_node_state_t
+pm_result_state(pm_result_t pmr, int i)
+{
+    if (pmr == NULL || pmr->pmr_magic != PMR_MAGIC
+                    || i < 0 || i >= pmr->pmr_count)
+        return PM_UNKNOWN;
+    return pmr->pmr_nodes[i].state;
+}
+
+pm_err_t
+pm_result_err(pm_result_t pmr, int i)
+{
+    if (pmr == NULL || pmr->pmr_magic != PMR_MAGIC
+                    || i < 0 || i >= pmr->pmr_count)
+        return PM_EBADARG;
+    return pmr->pmr_nodes[i].err;
+}
+
+char *
+pm_result_errstr(pm_result_t pmr, int i)
+{
+    if (pmr == NULL || pmr->pmr_magic != PMR_MAGIC
+                    || i < 0 || i >= pmr->pmr_count
+                    || pmr->pmr_nodes[i].errstr < 0)
+        return NULL;
+    return pmr->pmr_strs + pmr->pmr_nodes[i].errstr;
+}
+
+void
+pm_result_destroy(pm_result_t pmr)
+{
+    if (pmr == NULL || pmr->pmr_magic != PMR_MAGIC)
+        return;
+    if (pmr->pmr_nodes)
+        free(pmr->pmr_nodes);
+    if (pmr->pmr_strs)
+        free(pmr->pmr_strs);
+    pmr->pmr_magic = 0;
+    free(pmr);
 }
 
 /* Query server [pmh] for the power status of [node], and store it
@@ -497,25 +1217,19 @@ pm_disconnect(pm_handle_t pmh)
 pm_err_t
 pm_node_status(pm_handle_t pmh, char *node, pm_node_state_t *statep)
 {
-    char offstr[CP_LINEMAX], onstr[CP_LINEMAX];
+    pm_result_t pmr = NULL;
+    pm_node_state_t state = PM_UNKNOWN;
     pm_err_t err;
-    struct list_struct *resp;
-    pm_node_state_t state;
+    int i;
 
-    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
-        return PM_EBADHAND;
-    if ((err = _server_command(pmh, CP_STATUS, node, &resp)) != PM_ESUCCESS)
+    if ((err = pm_hosts_status(pmh, node, &pmr)) != PM_ESUCCESS) {
+        pm_result_destroy(pmr);
         return err;
-
-    snprintf(offstr, sizeof(offstr), CP_INFO_XSTATUS, node, "off");
-    snprintf(onstr,  sizeof(onstr),  CP_INFO_XSTATUS, node, "on");
-    if (_list_search(resp, offstr))
-        state = PM_OFF;
-    else if (_list_search(resp, onstr))
-        state = PM_ON;
-    else
-        state = PM_UNKNOWN;
-    _list_free(&resp);
+    }
+    for (i = 0; i < pm_result_count(pmr); i++)
+        if (strcmp(pm_result_node(pmr, i), node) == 0)
+            state = pm_result_state(pmr, i);
+    pm_result_destroy(pmr);
 
     if (statep)
         *statep = state;
@@ -527,9 +1241,7 @@ pm_node_status(pm_handle_t pmh, char *node, pm_node_state_t *statep)
 pm_err_t
 pm_node_on(pm_handle_t pmh, char *node)
 {
-    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
-        return PM_EBADHAND;
-    return _server_command(pmh, CP_ON, node, NULL);
+    return _hosts_op(pmh, PM_OP_ON, node, NULL);
 }
 
 /* Tell server [pmh] to turn [node] off.
@@ -537,9 +1249,7 @@ pm_node_on(pm_handle_t pmh, char *node)
 pm_err_t
 pm_node_off(pm_handle_t pmh, char *node)
 {
-    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
-        return PM_EBADHAND;
-    return _server_command(pmh, CP_OFF, node, NULL);
+    return _hosts_op(pmh, PM_OP_OFF, node, NULL);
 }
 
 /* Tell server [pmh] to cycle [node].
@@ -547,9 +1257,7 @@ pm_node_off(pm_handle_t pmh, char *node)
 pm_err_t
 pm_node_cycle(pm_handle_t pmh, char *node)
 {
-    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
-        return PM_EBADHAND;
-    return _server_command(pmh, CP_CYCLE, node, NULL);
+    return _hosts_op(pmh, PM_OP_CYCLE, node, NULL);
 }
 
 /* Convert error code to human readable string.
@@ -585,6 +1293,9 @@ pm_strerror(pm_err_t err, char *str, int len)
         case PM_ESERVERPARSE:
             strncpy(str, "unexpected response from server", len);
             break;
+        case PM_EAGAIN:
+            strncpy(str, "request has not completed yet", len);
+            break;
         case PM_EUNKNOWN:
             strncpy(str, "server: unknown command", len);
             break;
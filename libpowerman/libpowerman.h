@@ -31,6 +31,8 @@
 
 typedef struct pm_handle_struct         *pm_handle_t;
 typedef struct pm_node_iterator_struct  *pm_node_iterator_t;
+typedef struct pm_result_struct         *pm_result_t;
+typedef struct pm_request_struct        *pm_request_t;
 
 typedef enum {
     PM_UNKNOWN      = 0,
@@ -48,6 +50,7 @@ typedef enum {
     PM_EBADARG      = 6,    /* bad argument */
     PM_ESERVEREOF   = 7,    /* received unexpected EOF from server */
     PM_ESERVERPARSE = 8,    /* unexpected response from server */
+    PM_EAGAIN       = 9,    /* request has not completed yet */
     PM_EUNKNOWN     = 201,  /* server: unknown command (201) */
     PM_EPARSE       = 202,  /* server: parse error (202) */
     PM_ETOOLONG     = 203,  /* server: command too long (203) */
@@ -60,9 +63,17 @@ typedef enum {
     PM_EUNIMPL      = 213,  /* server: not implemented by device (213) */
 } pm_err_t;
 
+typedef enum {
+    PM_OP_STATUS    = 0,    /* query power status */
+    PM_OP_ON        = 1,    /* power on */
+    PM_OP_OFF       = 2,    /* power off */
+    PM_OP_CYCLE     = 3,    /* power cycle */
+} pm_op_t;
+
 /* flags for pm_connect() */
 #define PM_CONN_INET6   1   /* connect using IPv6 only */
 #define PM_CONN_COPROC  2   /* unimplemented */
+#define PM_CONN_PERSIST 4   /* reconnect automatically, with TCP keepalive */
 
 pm_err_t pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags);
 void     pm_disconnect(pm_handle_t pmh);
@@ -72,6 +83,24 @@ pm_err_t pm_node_on(pm_handle_t pmh, char *node);
 pm_err_t pm_node_off(pm_handle_t pmh, char *node);
 pm_err_t pm_node_cycle(pm_handle_t pmh, char *node);
 
+pm_err_t pm_hosts_status(pm_handle_t pmh, char *hosts, pm_result_t *resultp);
+pm_err_t pm_hosts_on(pm_handle_t pmh, char *hosts, pm_result_t *resultp);
+pm_err_t pm_hosts_off(pm_handle_t pmh, char *hosts, pm_result_t *resultp);
+pm_err_t pm_hosts_cycle(pm_handle_t pmh, char *hosts, pm_result_t *resultp);
+
+int             pm_result_count(pm_result_t pmr);
+char *          pm_result_node(pm_result_t pmr, int i);
+pm_node_state_t pm_result_state(pm_result_t pmr, int i);
+pm_err_t        pm_result_err(pm_result_t pmr, int i);
+char *          pm_result_errstr(pm_result_t pmr, int i);
+void            pm_result_destroy(pm_result_t pmr);
+
+int      pm_fd(pm_handle_t pmh);
+pm_err_t pm_submit(pm_handle_t pmh, pm_op_t op, char *hosts,
+                   pm_request_t *reqp);
+pm_err_t pm_poll(pm_handle_t pmh);
+pm_err_t pm_complete(pm_handle_t pmh, pm_request_t req, pm_result_t *resultp);
+
 pm_err_t pm_node_iterator_create(pm_handle_t pmh, pm_node_iterator_t *pmip);
 char *   pm_node_next(pm_node_iterator_t pmi);
 void     pm_node_iterator_reset(pm_node_iterator_t pmi);
@@ -64,8 +64,27 @@ typedef struct {
     char *fmt;
     char **argv;
     char *sendstr;
+    bool done;                  /* response complete (pipelined) */
+    int res;                    /* result of command, once done */
+    char *out;                  /* output held back until its turn */
+    int outlen;
+    int outsize;
 } cmd_t;
 
+/* Tag on the quit request when pipelining.
+ */
+#define QUIT_TAG "q"
+
+/* Server responses are read in large chunks into rbuf and split into lines
+ * in place.  Data from rbuf_start to rbuf_end has not been consumed yet.
+ * The buffer grows if a line does not fit (telemetry can be very long).
+ */
+#define RBUF_SIZE   (CP_LINEMAX * 8)
+static char *rbuf = NULL;
+static int  rbuf_size = 0;
+static int  rbuf_start = 0;
+static int  rbuf_end = 0;
+
 #if WITH_GENDERS
 static void _push_genders_hosts(hostlist_t targets, char *s);
 #endif
@@ -75,6 +94,8 @@ static int  _connect_to_server_pipe(char *server_path, char *config_path,
 static void _usage(void);
 static void _license(void);
 static void _version(void);
+static void _fill(int fd);
+static char *_readline(int fd);
 static int  _process_line(int fd);
 static void _expect(int fd, char *str);
 static int  _process_response(int fd);
@@ -84,7 +105,13 @@ static void _cmd_destroy(cmd_t *cp);
 static void _cmd_append(cmd_t *cp, char *arg);
 static void _cmd_prepare(cmd_t *cp, bool genders);
 static int  _cmd_execute(cmd_t *cp, int fd);
+static bool _cmd_is_query(cmd_t *cp);
+static bool _want_pipeline(List cl);
+static bool _start_pipeline(int fd);
+static int  _cmd_execute_batch(cmd_t **batch, int n, int fd,
+                               bool ignore_errs);
 static void _cmd_print(cmd_t *cp);
+static bool _supress(int num);
 
 static char *prog;
 
@@ -140,6 +167,9 @@ int main(int argc, char **argv)
     ListIterator itr;
     cmd_t *cp;
     bool short_circuit_delays = FALSE;
+    bool pipeline = FALSE;
+    cmd_t *batch[CP_PIPELINE_MAX];
+    int n;
 
     prog = basename(argv[0]);
     err_init(prog);
@@ -284,6 +314,11 @@ int main(int argc, char **argv)
         exit(0);
     }
 
+    /* Output is written in bulk, even to a terminal: stdout is flushed
+     * whenever the client has to wait for the server (see _fill()).
+     */
+    setvbuf(stdout, NULL, _IOFBF, RBUF_SIZE);
+
     /* Establish connection to server and start protocol.
      */
     if (server_path)
@@ -293,12 +328,28 @@ int main(int argc, char **argv)
         server_fd = _connect_to_server_tcp(host, port);
     _process_version(server_fd);
     _expect(server_fd, CP_PROMPT);
+    if (_want_pipeline(commands))
+        pipeline = _start_pipeline(server_fd);
 
-    /* Execute the commands.
+    /* Execute the commands.  When pipelining, consecutive queries are
+     * sent together and run concurrently; other commands run alone, since
+     * queries after them must see their effect.
      */
     itr = list_iterator_create(commands);
-    while ((cp = list_next(itr))) {
-        res = _cmd_execute(cp, server_fd);
+    cp = list_next(itr);
+    while (cp != NULL) {
+        if (pipeline) {
+            n = 0;
+            do {
+                batch[n++] = cp;
+                cp = list_next(itr);
+            } while (cp && n < CP_PIPELINE_MAX && _cmd_is_query(batch[0])
+                        && _cmd_is_query(cp));
+            res = _cmd_execute_batch(batch, n, server_fd, ignore_errs);
+        } else {
+            res = _cmd_execute(cp, server_fd);
+            cp = list_next(itr);
+        }
         if (ignore_errs)
             res = 0;
         if (res != 0)
@@ -309,8 +360,13 @@ int main(int argc, char **argv)
 
     /* Disconnect from server.
      */
-    hfdprintf(server_fd, "%s%s", CP_QUIT, CP_EOL);
-    _expect(server_fd, CP_RSP_QUIT);
+    if (pipeline) {
+        hfdprintf(server_fd, "%s %s%s", QUIT_TAG, CP_QUIT, CP_EOL);
+        _expect(server_fd, QUIT_TAG " " CP_RSP_QUIT);
+    } else {
+        hfdprintf(server_fd, "%s%s", CP_QUIT, CP_EOL);
+        _expect(server_fd, CP_RSP_QUIT);
+    }
 
     exit(res);
 }
@@ -387,6 +443,10 @@ static void _cmd_create(List cl, char *fmt, char *arg, bool prepend)
     cp->fmt = fmt;
     cp->argv = NULL;
     cp->sendstr = NULL;
+    cp->done = FALSE;
+    cp->res = 0;
+    cp->out = NULL;
+    cp->outlen = cp->outsize = 0;
     if (arg)
         cp->argv = argv_create(arg, "");
     if (prepend)
@@ -402,6 +462,8 @@ static void _cmd_destroy(cmd_t *cp)
     cp->magic = 0;
     if (cp->sendstr)
         xfree(cp->sendstr);
+    if (cp->out)
+        xfree(cp->out);
     if (cp->argv)
         argv_destroy(cp->argv);
     xfree(cp);
@@ -472,6 +534,147 @@ static int _cmd_execute(cmd_t *cp, int fd)
     return res;
 }
 
+/* Return TRUE if the command only reports node state, so it may run
+ * concurrently with other queries.  Device queries are left out since
+ * they report on the actions that earlier commands caused.
+ */
+static bool _cmd_is_query(cmd_t *cp)
+{
+    char *queries[] = { CP_STATUS, CP_STATUS_ALL, CP_TEMP, CP_TEMP_ALL,
+                        CP_BEACON, CP_BEACON_ALL, CP_NODES, NULL };
+    int i;
+
+    assert(cp->magic == CMD_MAGIC);
+    for (i = 0; queries[i] != NULL; i++)
+        if (!strcmp(cp->fmt, queries[i]))
+            return TRUE;
+    return FALSE;
+}
+
+/* Return TRUE if command list contains consecutive queries that would
+ * benefit from pipelining.
+ */
+static bool _want_pipeline(List cl)
+{
+    ListIterator itr;
+    cmd_t *cp;
+    bool prev = FALSE, want = FALSE;
+
+    itr = list_iterator_create(cl);
+    while ((cp = list_next(itr)) && !want) {
+        want = prev && _cmd_is_query(cp);
+        prev = _cmd_is_query(cp);
+    }
+    list_iterator_destroy(itr);
+    return want;
+}
+
+/* Ask the server to take pipelined requests.  Return FALSE if it is
+ * too old to know how, in which case it has sent another prompt.
+ */
+static bool _start_pipeline(int fd)
+{
+    char *buf;
+    long int num;
+
+    hfdprintf(fd, "%s%s", CP_PIPELINE, CP_EOL);
+    buf = _readline(fd);
+    num = strtol(buf, NULL, 10);
+    if (num == strtol(CP_RSP_PIPELINE, NULL, 10))
+        return TRUE;
+    if (!CP_IS_FAILURE(num))
+        err_exit(FALSE, "unexpected response from server");
+    _expect(fd, CP_PROMPT);
+    return FALSE;
+}
+
+/* Hold a line of output for a command that is not at the head of the
+ * batch yet.
+ */
+static void _cmd_save(cmd_t *cp, char *line)
+{
+    int len = strlen(line) + 1;
+
+    if (cp->outsize - cp->outlen < len) {
+        while (cp->outsize - cp->outlen < len)
+            cp->outsize += CP_LINEMAX;
+        cp->out = cp->out ? xrealloc(cp->out, cp->outsize)
+                          : xmalloc(cp->outsize);
+    }
+    memcpy(cp->out + cp->outlen, line, len - 1);
+    cp->out[cp->outlen + len - 1] = '\n';
+    cp->outlen += len;
+}
+
+/* Display held output for a command that has reached the head of the
+ * batch.
+ */
+static void _cmd_flush(cmd_t *cp)
+{
+    if (cp->outlen > 0)
+        fwrite(cp->out, 1, cp->outlen, stdout);
+    cp->outlen = 0;
+}
+
+/* Send a batch of commands tagged with their index and collect the
+ * interleaved responses.  Output is displayed in command order: the
+ * command at the head of the batch prints as its response arrives, and
+ * the others are held until it is done.  Unless errors are ignored,
+ * output stops after the first command that fails, as it would if the
+ * commands ran one at a time, but all responses are still read.
+ */
+static int _cmd_execute_batch(cmd_t **batch, int n, int fd, bool ignore_errs)
+{
+    int i, num, next = 0, pending = n, res = 0;
+    int len = 0, size = 0;
+    char *buf, *p, *req;
+
+    /* the whole batch goes to the server in one write */
+    for (i = 0; i < n; i++)
+        size += strlen(batch[i]->sendstr) + CP_TAGMAX + strlen(CP_EOL) + 2;
+    req = xmalloc(size);
+    for (i = 0; i < n; i++) {
+        assert(batch[i]->magic == CMD_MAGIC);
+        assert(batch[i]->sendstr != NULL);
+        batch[i]->done = FALSE;
+        batch[i]->outlen = 0;
+        len += snprintf(req + len, size - len, "%d %s%s", i,
+                        batch[i]->sendstr, CP_EOL);
+    }
+    xwrite_all(fd, req, len);
+    xfree(req);
+
+    while (pending > 0) {
+        buf = _readline(fd);
+        i = strtol(buf, &p, 10);
+        if (p == buf || *p != ' ' || i < 0 || i >= n || batch[i]->done)
+            err_exit(FALSE, "unexpected response from server");
+        p++;
+        num = strtol(p, NULL, 10);
+        if (strlen(p) <= 4)
+            err_exit(FALSE, "unexpected response from server");
+        if (!_supress(num)) {
+            if (i == next)
+                printf("%s\n", p + 4);
+            else if (next < n)
+                _cmd_save(batch[i], p + 4);
+        }
+        if (CP_IS_ALLDONE(num)) {
+            batch[i]->res = CP_IS_FAILURE(num) ? num : 0;
+            batch[i]->done = TRUE;
+            pending--;
+            while (next < n && batch[next]->done) {
+                if (batch[next]->res != 0 && !ignore_errs) {
+                    res = batch[next]->res;
+                    next = n;
+                } else if (++next < n)
+                    _cmd_flush(batch[next]);
+            }
+        }
+    }
+    return res;
+}
+
 static void _cmd_print(cmd_t *cp)
 {
     assert(cp->magic == CMD_MAGIC);
@@ -559,12 +762,60 @@ static bool _supress(int num)
     return FALSE;
 }
 
+/* Read more of the server's response into rbuf, first moving what is
+ * left to the front.  Any output waiting in stdout is written out before
+ * blocking, so it appears as soon as the server stops to think rather
+ * than a line at a time.
+ */
+static void _fill(int fd)
+{
+    int n;
+
+    if (rbuf_start > 0) {
+        memmove(rbuf, rbuf + rbuf_start, rbuf_end - rbuf_start);
+        rbuf_end -= rbuf_start;
+        rbuf_start = 0;
+    }
+    if (rbuf_end == rbuf_size) {
+        rbuf_size = rbuf_size ? rbuf_size * 2 : RBUF_SIZE;
+        rbuf = rbuf ? xrealloc(rbuf, rbuf_size) : xmalloc(rbuf_size);
+    }
+    fflush(stdout);
+    n = xread(fd, rbuf + rbuf_end, rbuf_size - rbuf_end);
+    if (n < 0)
+        err_exit(TRUE, "lost connection with server");
+    if (n == 0)
+        err_exit(FALSE, "EOF on read");
+    rbuf_end += n;
+}
+
+/* Return the next line of the server's response with its CP_EOL removed.
+ * The line is in rbuf and is only valid until the next read.
+ */
+static char *_readline(int fd)
+{
+    int scanned = 0;
+    char *line, *eol;
+
+    while (!(eol = memchr(rbuf + rbuf_start + scanned, '\n',
+                          rbuf_end - rbuf_start - scanned))) {
+        scanned = rbuf_end - rbuf_start;
+        _fill(fd);
+    }
+    line = rbuf + rbuf_start;
+    rbuf_start = eol + 1 - rbuf;
+    if (eol > line && eol[-1] == '\r')
+        eol--;
+    *eol = '\0';
+    return line;
+}
+
 /* Get a line from the socket and display on stdout.
  * Return the numerical portion of the repsonse.
  */
 static int _process_line(int fd)
 {
-    char *buf = xreadstr(fd);
+    char *buf = _readline(fd);
     long int num;
 
     num = strtol(buf, NULL, 10);
@@ -575,7 +826,6 @@ static int _process_line(int fd)
             printf("%s\n", buf + 4);
     } else
         err_exit(FALSE, "unexpected response from server");
-    xfree(buf);
     return num;
 }
 
@@ -583,7 +833,7 @@ static int _process_line(int fd)
  */
 static void _process_version(int fd)
 {
-    char *buf = xreadstr(fd);
+    char *buf = _readline(fd);
     char *vers = xmalloc (strlen(buf)+1);
 
     if (sscanf(buf, CP_VERSION, vers) != 1)
@@ -591,7 +841,6 @@ static void _process_version(int fd)
     if (strcmp(vers, PACKAGE_VERSION) != 0)
         err(FALSE, "warning: server version (%s) != client (%s)",
                 vers, PACKAGE_VERSION);
-    xfree(buf);
     xfree(vers);
 }
 
@@ -605,31 +854,24 @@ static int _process_response(int fd)
     return (CP_IS_FAILURE(num) ? num : 0);
 }
 
-/* Read strlen(str) bytes from file descriptor and exit if
- * it doesn't match 'str'.
+/* Consume strlen(str) bytes of response and exit if
+ * they don't match 'str'.
  */
 static void _expect(int fd, char *str)
 {
     int len = strlen(str);
-    char *buf = xmalloc (len + 1);
-    char *p = buf;
-    int res;
-
-    do {
-        res = xread(fd, p, len);
-        if (res < 0)
-           err_exit(TRUE, "lost connection with server");
-        p += res;
-        *p = '\0';
-        len -= res;
-    } while (strcmp(str, buf) != 0 && len > 0);
-
-    /* Shouldn't happen.  We are not handling the general case of the server
-     * returning the wrong response.  Read() loop above may hang in that case.
-     */
-    if (strcmp(str, buf) != 0)
-        err_exit(FALSE, "unexpected response from server");
-    xfree (buf);
+    int avail;
+
+    for (;;) {
+        avail = rbuf_end - rbuf_start;
+        if (avail > 0 && memcmp(rbuf + rbuf_start, str,
+                                avail < len ? avail : len) != 0)
+            err_exit(FALSE, "unexpected response from server");
+        if (avail >= len)
+            break;
+        _fill(fd);
+    }
+    rbuf_start += len;
 }
 
 /*
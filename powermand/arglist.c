@@ -24,10 +24,13 @@
 
 /* Args used to be stored in a List, but gprof showed that very large
  * configurations spent a lot of time doing linear search of arg list for
- * each arg->state update.  The List was traded for a hash, but as we still
- * want to iterate through args in the client in order, we keep the hostlist
- * representation of the nodes in the ArgList, and use it to implement an
- * 'iterator' interface.
+ * each arg->state update.  The List was traded for a hash, and the hash
+ * for an array indexed by node id (see conf_node_id()), so an ArgList is
+ * now a single allocation whatever the number of nodes.  Arg node names
+ * are shared with the config and not copied.  Args are kept in the order
+ * the nodes appear in the hostlist, for iteration in the client.
+ * Args that receive a result are also queued, so a client streaming
+ * results can send just the new ones without scanning the whole list.
  */
 
 #if HAVE_CONFIG_H
@@ -48,74 +51,101 @@
 #include "list.h"
 #include "xmalloc.h"
 #include "hostlist.h"
-#include "hash.h"
+#include "xtypes.h"
 #include "arglist.h"
+#include "parse_util.h"
+#include "intern.h"
 
 struct arglist_iterator {
-    hostlist_iterator_t itr;
+    int pos;
     ArgList arglist;
 };
 
 struct arglist {
-    hash_t args;
-    hostlist_t hl;
     int refcount;               /* free when refcount == 0 */
+    int nargs;                  /* number of Args (unique nodes) */
+    Arg *args;                  /* Args in hostlist order */
+    int norder;                 /* number of hosts in hostlist */
+    int *order;                 /* host position -> index in args[] */
+    int base;                   /* lowest node id */
+    int span;                   /* highest - lowest node id + 1 */
+    int *index;                 /* node id - base -> index in args[] + 1 */
+    int *fresh;                 /* queue of indices in args[] (circular) */
+    int fresh_head;             /* next to dequeue in fresh[] */
+    int fresh_count;            /* number queued in fresh[] */
 };
 
-static void _destroy_arg(Arg * arg)
-{
-    assert(arg != NULL);
-    assert(arg->node != NULL);
-    xfree(arg->node);
-    if (arg->val)
-        xfree(arg->val);
-    xfree(arg);
-}
-
-static Arg *_create_arg(char *node)
-{
-    Arg *arg = (Arg *) xmalloc(sizeof(Arg));
-
-    arg->node = xstrdup(node);
-    arg->state = ST_UNKNOWN;
-    arg->val = NULL;
-
-    return arg;
-}
-
 ArgList arglist_create(hostlist_t hl)
 {
-    ArgList new = (ArgList) xmalloc(sizeof(struct arglist));
+    ArgList new;
     hostlist_iterator_t itr;
     char *node;
-    int hash_size;
-
-    new->refcount = 1;
-    hash_size = hostlist_count(hl); /* reasonable? */
-    new->args = hash_create(hash_size, (hash_key_f)hash_key_string,
-            (hash_cmp_f)strcmp, (hash_del_f)_destroy_arg);
+    int *ids;
+    int i, n, lo, hi;
+    char *p;
 
+    /* look up node ids, and their range, before sizing the ArgList */
+    n = hostlist_count(hl);
+    ids = (int *)xmalloc((n > 0 ? n : 1) * sizeof(int));
     if ((itr = hostlist_iterator_create(hl)) == NULL) {
-        arglist_unlink(new);
+        xfree(ids);
         return NULL;
     }
-    while ((node = hostlist_next(itr)) != NULL) {
-        Arg *arg = _create_arg(node);
-
-        hash_insert(new->args, arg->node, arg);
-        free(node); /* hostlist_next strdups returned string */
+    lo = hi = -1;
+    for (i = 0; i < n && (node = intern_hostlist_next(itr)) != NULL; i++) {
+        ids[i] = conf_node_id(node);
+        if (ids[i] < 0) {
+            hostlist_iterator_destroy(itr);
+            xfree(ids);
+            errno = ENOENT;
+            return NULL;
+        }
+        if (lo == -1 || ids[i] < lo)
+            lo = ids[i];
+        if (hi == -1 || ids[i] > hi)
+            hi = ids[i];
     }
     hostlist_iterator_destroy(itr);
-    new->hl = hostlist_copy(hl);
+
+    p = xmalloc(sizeof(struct arglist) + n * sizeof(Arg) + 2 * n * sizeof(int)
+                + (hi - lo + 1) * sizeof(int));
+    new = (ArgList)p;
+    new->refcount = 1;
+    new->args = (Arg *)(p + sizeof(struct arglist));
+    new->order = (int *)(new->args + n);
+    new->fresh = new->order + n;
+    new->index = new->fresh + n;
+    new->norder = n;
+    new->base = lo;
+    new->span = hi - lo + 1;
+
+    for (i = 0; i < n; i++) {
+        int *slot = &new->index[ids[i] - lo];
+
+        if (*slot == 0) {
+            Arg *arg = &new->args[new->nargs];
+
+            arg->node = conf_node_name(ids[i]);
+            arg->state = ST_UNKNOWN;
+            arg->val = NULL;
+            *slot = ++new->nargs;
+        }
+        new->order[i] = *slot - 1;
+    }
+    xfree(ids);
 
     return new;
 }
 
 void arglist_unlink(ArgList arglist)
 {
+    int i;
+
     if (--arglist->refcount == 0) {
-        hash_destroy(arglist->args);
-        hostlist_destroy(arglist->hl);
+        for (i = 0; i < arglist->nargs; i++) {
+            if (arglist->args[i].val)
+                xfree(arglist->args[i].val);
+        }
         xfree(arglist);
     }
 }
@@ -127,13 +157,38 @@ ArgList arglist_link(ArgList arglist)
     return arglist;
 }
 
-Arg *arglist_find(ArgList arglist, char *node)
+Arg *arglist_find(ArgList arglist, int nodeid)
 {
-    Arg *arg = NULL;
+    int i = nodeid - arglist->base;
+
+    if (nodeid < 0 || i < 0 || i >= arglist->span || !arglist->index[i])
+        return NULL;
 
-    if (node != NULL)
-        arg = hash_find(arglist->args, node);
+    return &arglist->args[arglist->index[i] - 1];
+}
+
+void arglist_set_fresh(ArgList arglist, Arg *arg)
+{
+    int tail;
+
+    if (arg->fresh || arg->reported)
+        return;
+    assert(arglist->fresh_count < arglist->nargs);
+    tail = (arglist->fresh_head + arglist->fresh_count++) % arglist->nargs;
+    arglist->fresh[tail] = arg - arglist->args;
+    arg->fresh = TRUE;
+}
 
+Arg *arglist_next_fresh(ArgList arglist)
+{
+    Arg *arg;
+
+    if (arglist->fresh_count == 0)
+        return NULL;
+    arg = &arglist->args[arglist->fresh[arglist->fresh_head]];
+    arglist->fresh_head = (arglist->fresh_head + 1) % arglist->nargs;
+    arglist->fresh_count--;
+    arg->fresh = FALSE;
     return arg;
 }
 
@@ -142,29 +197,24 @@ ArgListIterator arglist_iterator_create(ArgList arglist)
     ArgListIterator itr = (ArgListIterator)xmalloc(sizeof(struct arglist_iterator));
 
     itr->arglist = arglist;
-    itr->itr = hostlist_iterator_create(arglist->hl);
+    itr->pos = 0;
 
     return itr;
 }
 
 void arglist_iterator_destroy(ArgListIterator itr)
 {
-    hostlist_iterator_destroy(itr->itr);
     xfree(itr);
 }
 
 Arg *arglist_next(ArgListIterator itr)
 {
-    Arg *arg = NULL;
-    char *node;
+    ArgList arglist = itr->arglist;
 
-    node = hostlist_next(itr->itr);
-    if (node != NULL) {
-        arg = hash_find(itr->arglist->args, node);
-        free(node); /* hostlist_next strdups returned string */
-    }
+    if (itr->pos >= arglist->norder)
+        return NULL;
 
-    return arg;
+    return &arglist->args[arglist->order[itr->pos++]];
 }
 
 /*
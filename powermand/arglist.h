@@ -9,15 +9,19 @@
 typedef enum { ST_UNKNOWN, ST_OFF, ST_ON } InterpState;
 
 typedef struct {
-    char *node;                 /* node name (in) */
+    char *node;                 /* node name, shared - do not free (in) */
     char *val;                  /* value as returned by the device (out) */
     InterpState state;          /* interpreted value, if appropriate (out) */
+    bool reported;              /* result already sent to client */
+    bool fresh;                 /* queued for arglist_next_fresh() */
+    const char *error;          /* cause if the device failed (out) */
 } Arg;
 
 typedef struct arglist_iterator *ArgListIterator;
 typedef struct arglist *ArgList;
 
 /* Create an ArgList with an Arg entry for each node in hl (refcount == 1).
+ * All nodes must be configured (see conf_node_id()).
  */
 ArgList          arglist_create(hostlist_t hl);
 
@@ -30,11 +34,20 @@ ArgList          arglist_link(ArgList arglist);
  */
 void             arglist_unlink(ArgList arglist);
 
-/* Search ArgList for an Arg entry that matches node.
+/* Search ArgList for an Arg entry that matches node id.
  * Return pointer to Arg on success (points to actual list entry),
  * or NULL on search failure.
  */
-Arg *            arglist_find(ArgList arglist, char *node);
+Arg *            arglist_find(ArgList arglist, int nodeid);
+
+/* Queue an Arg that has just received a result, unless it is already
+ * queued or reported, so that arglist_next_fresh() returns it.
+ */
+void             arglist_set_fresh(ArgList arglist, Arg *arg);
+
+/* Return the next queued Arg, in the order they were queued, or NULL.
+ */
+Arg *            arglist_next_fresh(ArgList arglist);
 
 /* An iterator interface for ArgLists, similar to the iterators in list.h.
  */
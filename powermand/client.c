@@ -53,6 +53,7 @@
 #include "xregex.h"
 #include "hostlist.h"
 #include "list.h"
+#include "hash.h"
 #include "parse_util.h"
 #include "client.h"
 #include "cbuf.h"
@@ -61,7 +62,10 @@
 #include "debug.h"
 #include "pluglist.h"
 #include "hprintf.h"
+#include "arena.h"
+#include "pool.h"
 #include "arglist.h"
+#include "intern.h"
 #include "device_private.h"
 #include "xpty.h"
 #include "powerman.h"
@@ -75,16 +79,55 @@ typedef int socklen_t;                  /* socklen_t is uint32_t in Posix.1g */
 #define MIN_CLIENT_BUF     1024
 #define MAX_CLIENT_BUF     1024*1024
 
-typedef struct {
+/* A client with more than this much output not yet sent is not read from,
+ * so a pipelining client that does not read its replies cannot make
+ * the daemon buffer without limit (see _client_backlogged()).
+ */
+#define MAX_CLIENT_BACKLOG (MAX_CLIENT_BUF/2)
+
+#define CMD_ARENA_CHUNK    4096
+
+/* Released Clients, Commands and client cbufs are kept in pools of at most
+ * this many objects so short lived connections do not churn the heap.
+ * A cbuf that has grown beyond MIN_CLIENT_BUF is not retained.
+ */
+#define CLI_POOL_MAX       16
+
+/* Commands in progress are indexed by id, so device action callbacks find
+ * theirs without searching every client.  Ids are handed out in sequence,
+ * so the id itself is a good hash key.
+ */
+#define CLI_CMD_HASH_SIZE  1024
+
+/* Strings that live as long as a command (its tag) come from the
+ * command's arena and are released when the command completes.
+ * Device actions refer to their command by id, since the client (and
+ * with it the command) may go away before the actions complete.
+ */
+struct client;
+typedef struct command {
+    int id;                     /* command identifier */
+    struct client *client;      /* client that issued the command */
+    char *tag;                  /* request tag if pipelined, else NULL */
     int com;                    /* script index */
     hostlist_t hl;              /* target nodes */
     int pending;                /* count of pending device actions */
     bool error;                 /* cumulative error flag for actions */
     ArgList arglist;            /* argument for query commands */
+    Arena arena;                /* temporaries for this command */
+    struct command *batch;      /* batch this command is part of, or NULL */
+    List parts;                 /* if a batch, its commands in order */
+    bool replied;               /* reply sent (for a part of a batch) */
+    bool json;                  /* reply as JSON (client mode when issued) */
 } Command;
 
+/* A batch is a Command with this 'com' whose 'pending' counts the parts
+ * still in progress.  Device actions refer to the parts, not the batch.
+ */
+#define CMD_BATCH          (-1)
+
 #define CLI_MAGIC    0xdadadada
-typedef struct {
+typedef struct client {
     int magic;
     int fd;                     /* file desriptor for the socket */
     int ofd;                    /* separate output file descriptor (if used) */
@@ -93,23 +136,28 @@ typedef struct {
     char *host;                 /* host name of client host */
     cbuf_t to;                  /* out buffer */
     cbuf_t from;                /* in buffer */
-    Command *cmd;               /* command (there can be only one) */
-    int client_id;              /* client identifier */
+    List cmds;                  /* commands in progress (one unless pipelined) */
+    char *tag;                  /* tag for response lines being written */
     bool telemetry;             /* client wants telemetry debugging info */
     bool exprange;              /* client wants host ranges expanded */
+    bool pipeline;              /* client sends tagged, pipelined requests */
+    bool stream;                /* client wants query results as they come */
+    bool json;                  /* client wants query results as JSON */
     bool client_quit;           /* set true after client quit command */
 } Client;
 
 /* prototypes for internal functions */
 static Command *_create_command(Client * c, int com, char *arg1);
+static Command *_create_batch(Client * c, char *str);
 static void _destroy_command(Command * cmd);
-static int _match_client(Client * c, void *key);
-static Client *_find_client(int client_id);
+static void _put_cbuf(cbuf_t cb);
+static Command *_find_command(int id);
 static hostlist_t _hostlist_create_validated(Client * c, char *str);
 static void _client_query_nodes_reply(Client * c);
 static void _client_query_device_reply(Client * c, char *arg);
-static void _client_query_status_reply(Client * c, bool error);
-static void _client_query_status_reply_nointerp(Client * c, bool error);
+static void _client_query_status_reply(Client * c, Command * cmd);
+static void _client_query_status_reply_nointerp(Client * c, Command * cmd);
+static void _client_query_stream_reply(Client * c, Command * cmd);
 static void _handle_read(Client * c);
 static void _handle_write(Client * c);
 static void _handle_input(Client *c);
@@ -118,8 +166,8 @@ static void _parse_input(Client * c, char *input);
 static void _destroy_client(Client * c);
 static void _create_client_socket(int fd);
 static void _create_client_stdio(void);
-static void _act_finish(int client_id, ActError acterr, const char *fmt, ...);
-static void _telemetry_printf(int client_id, const char *fmt, ...);
+static void _act_finish(int cmd_id, ActError acterr, const char *fmt, ...);
+static void _telemetry_printf(int cmd_id, const char *fmt, ...);
 #if HAVE_TCP_WRAPPERS
 /* tcp wrappers support */
 extern int hosts_ctl(char *daemon, char *client_name, char *client_addr,
@@ -131,58 +179,280 @@ int deny_severity = LOG_WARNING;/* logging level for rejected reqs */
 static int *listen_fds;         /* powermand listen sockets */
 static int listen_fds_len = 0;  /* count of above sockets */
 static List cli_clients = NULL; /* list of clients */
+static hash_t cli_cmds = NULL;  /* command id -> Command in progress */
+static Pool cli_client_pool = NULL;
+static Pool cli_command_pool = NULL;
+static Pool cli_cbuf_pool = NULL;
 static bool one_client = FALSE; /* terminate after first client */
 static bool server_done = FALSE;/* true when stdio client exits */
 
-static int cli_id_seq = 1;      /* range 1...INT_MAX */
-#define _next_cli_id() \
-    (cli_id_seq < INT_MAX ? cli_id_seq++ : (cli_id_seq = 1, INT_MAX))
+/* JSON reply line being built (see _json_begin), reused for every line */
+static char *json_buf = NULL;
+static int json_size = 0;
+static int json_len = 0;
+static bool json_sep = FALSE;   /* next member needs a comma */
+
+/* Reply text being written (see _client_printf), reused for every reply */
+static char *fmt_buf = NULL;
+static int fmt_size = 0;
+
+static int cmd_id_seq = 1;      /* range 1...INT_MAX */
+#define _next_cmd_id() \
+    (cmd_id_seq < INT_MAX ? cmd_id_seq++ : (cmd_id_seq = 1, INT_MAX))
 
 #define _internal_error_response(c) \
     _client_printf(c, CP_ERR_INTERNAL, __FILE__, __LINE__)
 
 #include "hostlist.h"
 
+
 /*
- * Wrapped hostlist_ranged_string() with internal buffer allocation,
- * which caller must xfree().
+ * Helper for _client_write.  Replace the full output cbuf with one twice
+ * its size holding the same unread data.
  */
-#define CHUNKSIZE 80
-static char *_xhostlist_ranged_string(hostlist_t hl)
+static void _grow_cbuf(Client *c)
 {
-    int size = 0;
-    char *str = NULL;
-
-    do {
-        str = (size == 0) ? xmalloc(CHUNKSIZE) : xrealloc(str, size+CHUNKSIZE);
-        size += CHUNKSIZE;
-    } while (hostlist_ranged_string(hl, size, str) == -1);
+    int size = cbuf_size(c->to) * 2;
+    cbuf_t cb = cbuf_create(size, size);
+
+    if (cbuf_opt_set(cb, CBUF_OPT_OVERWRITE, CBUF_NO_DROP) < 0)
+        err_exit(TRUE, "cbuf_opt_set");
+    if (cbuf_move(c->to, cb, -1, NULL) < 0)
+        err_exit(TRUE, "cbuf_move");
+    dbg(DBG_CLIENT, "output buffer grown to %d bytes", size);
+    _put_cbuf(c->to);
+    c->to = cb;
+}
 
-    return str;
+/*
+ * Helper for _client_printf.  Write 'len' bytes to the output cbuf.
+ * The output cbuf never drops data: a reply bigger than the space left
+ * grows it, and the whole reply is kept until the client reads it.
+ */
+static void _client_write(Client *c, char *str, int len)
+{
+    int written;
+
+    while (len > 0) {
+        written = cbuf_write(c->to, str, len, NULL);
+        if (written < 0) {
+            if (errno != ENOSPC) {
+                err(TRUE, "_client_printf: cbuf_write");
+                return;
+            }
+            _grow_cbuf(c);
+            continue;
+        }
+        str += written;
+        len -= written;
+    }
 }
 
 /*
  * printf-like function which writes to the output cbuf.
+ * If c->tag is set, each line written is prefixed with it.
  */
 static void _client_printf(Client *c, const char *fmt, ...)
 {
-    char *str = NULL;
-    int written, dropped;
+    char *str;
     va_list ap;
+    int len;
 
+    /* Format into fmt_buf, growing it once if the text does not fit */
+    if (fmt_size == 0) {
+        fmt_size = CP_LINEMAX;
+        fmt_buf = xmalloc(fmt_size);
+    }
     va_start(ap, fmt);
-    str = hvsprintf(fmt, ap);
+    len = vsnprintf(fmt_buf, fmt_size, fmt, ap);
     va_end(ap);
+    if (len >= fmt_size) {
+        while (len >= fmt_size)
+            fmt_size *= 2;
+        fmt_buf = xrealloc(fmt_buf, fmt_size);
+        va_start(ap, fmt);
+        vsnprintf(fmt_buf, fmt_size, fmt, ap);
+        va_end(ap);
+    } else if (len < 0)
+        fmt_buf[0] = '\0';
+    str = fmt_buf;
 
     /* Write to the client buffer */
-    written = cbuf_write(c->to, str, strlen(str), &dropped);
-    if (written < 0)
-        err(TRUE, "_client_printf: cbuf_write returned %d", written);
-    else if (dropped > 0)
-        err(FALSE, "_client_printf: cbuf_write dropped %d chars", dropped);
+    if (c->tag) {
+        char *line = str, *eol;
+
+        while (*line) {
+            eol = strchr(line, '\n');
+            _client_write(c, c->tag, strlen(c->tag));
+            _client_write(c, " ", 1);
+            if (!eol) {
+                _client_write(c, line, strlen(line));
+                break;
+            }
+            _client_write(c, line, eol - line + 1);
+            line = eol + 1;
+        }
+    } else
+        _client_write(c, str, strlen(str));
+}
+
+/*
+ * Helpers for building the JSON object in a 309 reply line.
+ * Call _json_begin(), add members, then _json_end() to send the line.
+ */
+static void _json_putmem(const char *mem, int len)
+{
+    if (json_len + len + 1 > json_size) {
+        while (json_len + len + 1 > json_size)
+            json_size = json_size ? json_size * 2 : CP_LINEMAX;
+        json_buf = json_buf ? xrealloc(json_buf, json_size)
+                            : xmalloc(json_size);
+    }
+    memcpy(json_buf + json_len, mem, len);
+    json_len += len;
+    json_buf[json_len] = '\0';
+}
+
+static void _json_puts(const char *str)
+{
+    _json_putmem(str, strlen(str));
+}
+
+/* Add a quoted string, or null.  Device responses may contain any byte,
+ * so control characters and bytes above 0x7e are escaped as \u00XX.
+ */
+static void _json_quote(const char *str)
+{
+    const char *p, *run;
+    char esc[8];
+
+    if (str == NULL) {
+        _json_puts("null");
+        return;
+    }
+    _json_puts("\"");
+    for (p = run = str; *p; p++) {
+        unsigned char ch = *p;
+
+        if (ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\')
+            continue;
+        _json_putmem(run, p - run);
+        if (ch == '"' || ch == '\\')
+            snprintf(esc, sizeof(esc), "\\%c", ch);
+        else
+            snprintf(esc, sizeof(esc), "\\u%04x", ch);
+        _json_puts(esc);
+        run = p + 1;
+    }
+    _json_putmem(run, p - run);
+    _json_puts("\"");
+}
+
+static void _json_key(const char *key)
+{
+    if (json_sep)
+        _json_puts(",");
+    _json_quote(key);
+    _json_puts(":");
+    json_sep = TRUE;
+}
+
+static void _json_begin(void)
+{
+    json_len = 0;
+    json_sep = FALSE;
+    _json_puts("{");
+}
+
+static void _json_str(const char *key, const char *val)
+{
+    _json_key(key);
+    _json_quote(val);
+}
+
+static void _json_int(const char *key, int val)
+{
+    char tmpstr[16];
+
+    snprintf(tmpstr, sizeof(tmpstr), "%d", val);
+    _json_key(key);
+    _json_puts(tmpstr);
+}
+
+static void _json_end(Client *c)
+{
+    _json_puts("}");
+    _client_printf(c, CP_INFO_JSON, json_buf);
+}
+
+/* key and compare functions for cli_cmds */
+static unsigned int _cmd_hash_key(const int *id)
+{
+    return (unsigned int)*id;
+}
+
+static int _cmd_hash_cmp(const int *id1, const int *id2)
+{
+    return (*id1 != *id2);
+}
+
+/*
+ * Pool create/destroy functions.  A pooled Client keeps its (empty)
+ * command list and a pooled Command keeps its arena.
+ */
+static Client *_alloc_client(void)
+{
+    Client *c = (Client *) xmalloc(sizeof(Client));
+
+    c->cmds = list_create((ListDelF) _destroy_command);
+    return c;
+}
+
+static void _free_client(Client *c)
+{
+    list_destroy(c->cmds);
+    xfree(c);
+}
+
+static Command *_alloc_command(void)
+{
+    Command *cmd = (Command *) xmalloc(sizeof(Command));
 
-    /* Free the tmp string */
-    xfree(str);
+    cmd->arena = arena_create(CMD_ARENA_CHUNK);
+    return cmd;
+}
+
+static void _free_command(Command *cmd)
+{
+    arena_destroy(cmd->arena);
+    xfree(cmd);
+}
+
+static cbuf_t _alloc_cbuf(void)
+{
+    return cbuf_create(MIN_CLIENT_BUF, MAX_CLIENT_BUF);
+}
+
+/* Output cbufs must not drop data (see _client_write()), input cbufs
+ * keep the default behavior.
+ */
+static cbuf_t _get_cbuf(cbuf_overwrite_t overwrite)
+{
+    cbuf_t cb = (cbuf_t) pool_get(cli_cbuf_pool);
+
+    if (cbuf_opt_set(cb, CBUF_OPT_OVERWRITE, overwrite) < 0)
+        err_exit(TRUE, "cbuf_opt_set");
+    return cb;
+}
+
+static void _put_cbuf(cbuf_t cb)
+{
+    if (cbuf_size(cb) > MIN_CLIENT_BUF)
+        cbuf_destroy(cb);
+    else {
+        cbuf_flush(cb);
+        pool_put(cli_cbuf_pool, cb);
+    }
 }
 
 /*
@@ -192,6 +462,18 @@ void cli_init(void)
 {
     /* create cli_clients list */
     cli_clients = list_create((ListDelF) _destroy_client);
+
+    cli_client_pool = pool_create(CLI_POOL_MAX, (PoolCreateF)_alloc_client,
+                                  (PoolDestroyF)_free_client);
+    cli_command_pool = pool_create(CLI_POOL_MAX, (PoolCreateF)_alloc_command,
+                                   (PoolDestroyF)_free_command);
+    cli_cbuf_pool = pool_create(2 * CLI_POOL_MAX, (PoolCreateF)_alloc_cbuf,
+                                (PoolDestroyF)cbuf_destroy);
+
+    cli_cmds = hash_create(CLI_CMD_HASH_SIZE, (hash_key_f)_cmd_hash_key,
+                           (hash_cmp_f)_cmd_hash_cmp, NULL);
+    if (cli_cmds == NULL)
+        err_exit(TRUE, "hash_create");
 }
 
 /*
@@ -201,20 +483,36 @@ void cli_fini(void)
 {
     /* destroy clients */
     list_destroy(cli_clients);
+
+    dbg(DBG_MEMORY, "cli_fini: %d clients, %d allocated",
+            pool_gets(cli_client_pool), pool_creates(cli_client_pool));
+    dbg(DBG_MEMORY, "cli_fini: %d commands, %d allocated",
+            pool_gets(cli_command_pool), pool_creates(cli_command_pool));
+    dbg(DBG_MEMORY, "cli_fini: %d cbufs, %d allocated",
+            pool_gets(cli_cbuf_pool), pool_creates(cli_cbuf_pool));
+    hash_destroy(cli_cmds);
+    cli_cmds = NULL;
+    pool_destroy(cli_client_pool);
+    pool_destroy(cli_command_pool);
+    pool_destroy(cli_cbuf_pool);
+
+    if (json_buf)
+        xfree(json_buf);
+    json_buf = NULL;
+    json_size = 0;
+    if (fmt_buf)
+        xfree(fmt_buf);
+    fmt_buf = NULL;
+    fmt_size = 0;
 }
 
 /*
- * Build a hostlist_t from a string, validating each node name against
- * powerman configuration.  If any bogus nodes are found, issue error
- * response to client and return NULL.
+ * Build a hostlist_t from a string and expand aliases.  If the string
+ * cannot be parsed, issue error response to client and return NULL.
  */
-static hostlist_t _hostlist_create_validated(Client * c, char *str)
+static hostlist_t _hostlist_create_expanded(Client * c, char *str)
 {
-    hostlist_t hl = NULL;
-    hostlist_t badhl = NULL;
-    hostlist_iterator_t itr = NULL;
-    char *host;
-    bool valid = TRUE;
+    hostlist_t hl;
 
     if ((hl = hostlist_create(str)) == NULL) {
         /* Note: report detailed error since 'str' comes from the user */
@@ -224,37 +522,56 @@ static hostlist_t _hostlist_create_validated(Client * c, char *str)
             _internal_error_response(c);
         return NULL;
     }
-    conf_exp_aliases(hl);
-    if ((badhl = hostlist_create(NULL)) == NULL) {
-        /* Note: other hostlist failures not user-induced so OK to be vague */
-        _internal_error_response(c);
+    return conf_exp_aliases(hl);
+}
+
+/*
+ * Check the target nodes in 'hb' against powerman configuration (leaving
+ * only the bogus ones in 'hb').  If any are found, issue error response
+ * to client and return FALSE.
+ */
+static bool _hostbits_validate(Client * c, hostbits_t hb)
+{
+    char *hosts;
+
+    /* bad nodes = targets - configured nodes */
+    hostbits_subtract(hb, conf_getnodebits());
+    if (hostbits_is_empty(hb))
+        return TRUE;
+    if ((hosts = hostbits_ranged_string_malloc(hb)) == NULL)
+        err_exit(FALSE, "hostbits_ranged_string_malloc failed");
+    _client_printf(c, CP_ERR_NOSUCHNODES, hosts);
+    free (hosts);
+    return FALSE;
+}
+
+/*
+ * Build a hostlist_t from a string, validating each node name against
+ * powerman configuration.  If any bogus nodes are found, issue error
+ * response to client and return NULL.
+ */
+static hostlist_t _hostlist_create_validated(Client * c, char *str)
+{
+    hostlist_t hl = NULL;
+    hostbits_t badhb = NULL;
+
+    if ((hl = _hostlist_create_expanded(c, str)) == NULL)
         return NULL;
-    }
-    if ((itr = hostlist_iterator_create(hl)) == NULL) {
+    if ((badhb = hostbits_create(NULL)) == NULL
+            || hostbits_insert_list(badhb, hl) < 0) {
+        /* Note: other hostlist failures not user-induced so OK to be vague */
         _internal_error_response(c);
+        if (badhb)
+            hostbits_destroy(badhb);
         hostlist_destroy(hl);
         return NULL;
     }
-    while ((host = hostlist_next(itr)) != NULL) {
-        if (!conf_node_exists(host)) {
-            valid = FALSE;
-            hostlist_push_host(badhl, host);
-        }
-        free(host); /* hostlist_next strdups returned string */
-    }
-    if (!valid) {
-        char *hosts;
-
-        hosts = _xhostlist_ranged_string(badhl);
-        _client_printf(c, CP_ERR_NOSUCHNODES, hosts);
-        xfree (hosts);
-        hostlist_iterator_destroy(itr);
+    if (!_hostbits_validate(c, badhb)) {
         hostlist_destroy(hl);
-        hostlist_destroy(badhl);
+        hostbits_destroy(badhb);
         return NULL;
     }
-    hostlist_iterator_destroy(itr);
-    hostlist_destroy(badhl);
+    hostbits_destroy(badhb);
     return hl;
 }
 
@@ -267,7 +584,28 @@ static void _client_query_nodes_reply(Client * c)
 
     hostlist_sort(nodes);
 
-    if (c->exprange) {
+    if (c->json) {
+        hostlist_iterator_t itr;
+        Device *dev;
+        Plug *plug;
+        char *node;
+
+        if ((itr = hostlist_iterator_create(nodes)) == NULL) {
+            _internal_error_response(c);
+            return;
+        }
+        while ((node = intern_hostlist_next(itr))) {
+            plug = NULL;
+            dev = dev_findbynode(node, &plug);
+            _json_begin();
+            _json_str("node", node);
+            _json_str("device", dev ? dev->name : NULL);
+            _json_str("plug", plug ? plug->name : NULL);
+            _json_end(c);
+        }
+        hostlist_iterator_destroy(itr);
+
+    } else if (c->exprange) {
         hostlist_iterator_t itr;
         char *node;
 
@@ -282,19 +620,21 @@ static void _client_query_nodes_reply(Client * c)
         hostlist_iterator_destroy(itr);
 
     } else {
-        char *hosts = _xhostlist_ranged_string(nodes);
+        char *hosts = hostlist_ranged_string_malloc(nodes);
 
+        if (hosts == NULL)
+            err_exit(FALSE, "hostlist_ranged_string_malloc failed");
         _client_printf(c, CP_INFO_NODES, hosts);
-        xfree (hosts);
+        free (hosts);
     }
 
     _client_printf(c, CP_RSP_QRY_COMPLETE);
 }
 
 /*
- * Helper for _client_query_device_reply() .
+ * Helper for _client_query_device_reply() and _client_json_device().
  * Create a hostlist string for the nodes attached to the specified device.
- * Caller must xfree().
+ * Caller must free().
  */
 static char *_make_pluglist_str(Device * dev)
 {
@@ -312,7 +652,7 @@ static char *_make_pluglist_str(Device * dev)
         pluglist_iterator_destroy(itr);
 
         hostlist_sort(hl);
-        str = _xhostlist_ranged_string(hl);
+        str = hostlist_ranged_string_malloc(hl);
         hostlist_destroy(hl);
     }
     return str;
@@ -343,6 +683,28 @@ static bool _device_matches_targets(Device *dev, char *arg)
     return res;
 }
 
+/*
+ * Helper for _client_query_device_reply.  Send a device as a JSON object.
+ */
+static void _client_json_device(Client *c, Device *dev)
+{
+    int con = dev->stat_successful_connects;
+    char *nodelist = _make_pluglist_str(dev);
+
+    _json_begin();
+    _json_str("device", dev->name);
+    _json_str("state", dev->connect_state == DEV_CONNECTED ? "connected"
+                     : dev->connect_state == DEV_CONNECTING ? "connecting"
+                     : "disconnected");
+    _json_int("reconnects", con > 0 ? con - 1 : 0);
+    _json_int("actions", dev->stat_successful_actions);
+    _json_str("type", dev->specname);
+    _json_str("nodes", nodelist);
+    _json_end(c);
+    if (nodelist)
+        free(nodelist);
+}
+
 /*
  * Reply to client request for list of devices in powerman configuration.
  */
@@ -362,6 +724,10 @@ static void _client_query_device_reply(Client * c, char *arg)
             if (arg && !_device_matches_targets(dev, arg))
                 continue;
 
+            if (c->json) {
+                _client_json_device(c, dev);
+                continue;
+            }
             if ((nodelist = _make_pluglist_str(dev))) {
                 _client_printf(c, CP_INFO_DEVICE,
                         dev->name,
@@ -372,7 +738,7 @@ static void _client_query_device_reply(Client * c, char *arg)
                         dev->stat_successful_actions,
                         dev->specname,
                         nodelist);
-                xfree (nodelist);
+                free (nodelist);
             }
         }
         list_iterator_destroy(itr);
@@ -380,19 +746,100 @@ static void _client_query_device_reply(Client * c, char *arg)
     _client_printf(c, CP_RSP_QRY_COMPLETE);
 }
 
+/*
+ * Send the result of a command for one node as a JSON object.  Power
+ * control commands have no state or value to report.
+ */
+static void _client_json_arg(Client *c, Command *cmd, Arg *arg)
+{
+    Plug *plug = NULL;
+    Device *dev = dev_findbynode(arg->node, &plug);
+
+    _json_begin();
+    _json_str("node", arg->node);
+    if (cmd->com == PM_STATUS_PLUGS || cmd->com == PM_STATUS_BEACON)
+        _json_str("state", arg->state == ST_ON ? "on"
+                         : arg->state == ST_OFF ? "off" : "unknown");
+    if (cmd->com == PM_STATUS_PLUGS || cmd->com == PM_STATUS_BEACON
+                                    || cmd->com == PM_STATUS_TEMP)
+        _json_str("value", arg->val);
+    _json_str("device", dev ? dev->name : NULL);
+    _json_str("plug", plug ? plug->name : NULL);
+    _json_str("error", arg->error);
+    _json_end(c);
+}
+
+/*
+ * Send results for a streaming query that have come in since the last call
+ * (only the Args queued as fresh are visited, not the whole list).
+ * Each Arg is sent once, and Args still without a result are left for the
+ * final reply.
+ */
+static void _client_query_stream_reply(Client * c, Command * cmd)
+{
+    Arg *arg;
+
+    while ((arg = arglist_next_fresh(cmd->arglist))) {
+        if (arg->reported)
+            continue;
+        if (cmd->com == PM_STATUS_TEMP) {
+            if (arg->val == NULL)
+                continue;
+            if (cmd->json)
+                _client_json_arg(c, cmd, arg);
+            else
+                _client_printf(c, CP_INFO_XSTATUS, arg->node, arg->val);
+        } else if (cmd->json) {
+            if (arg->state == ST_UNKNOWN)
+                continue;
+            _client_json_arg(c, cmd, arg);
+        } else {
+            if (arg->state == ST_UNKNOWN)
+                continue;
+            _client_printf(c, CP_INFO_XSTATUS, arg->node,
+                    arg->state == ST_ON ? "on" : "off");
+        }
+        arg->reported = TRUE;
+    }
+}
+
+/*
+ * Send the final line of a reply, unless the command is part of a batch,
+ * which sends one final line for all its parts.
+ */
+static void _client_reply_done(Client * c, Command * cmd, bool query)
+{
+    if (cmd->batch)
+        return;
+    if (query)
+        _client_printf(c, cmd->error ? CP_ERR_QRY_COMPLETE
+                                     : CP_RSP_QRY_COMPLETE);
+    else
+        _client_printf(c, cmd->error ? CP_ERR_COM_COMPLETE
+                                     : CP_RSP_COM_COMPLETE);
+}
+
 /*
  * Reply to client request for plug/soft status.
  */
-static void _client_query_status_reply(Client * c, bool error)
+static void _client_query_status_reply(Client * c, Command * cmd)
 {
     Arg *arg;
     ArgListIterator itr;
 
-    assert(c->cmd != NULL);
+    if (cmd->json) {
+        itr = arglist_iterator_create(cmd->arglist);
+        while ((arg = arglist_next(itr))) {
+            if (!arg->reported)
+                _client_json_arg(c, cmd, arg);
+        }
+        arglist_iterator_destroy(itr);
 
-    if (c->exprange) {
-        itr = arglist_iterator_create(c->cmd->arglist);
+    } else if (c->exprange || c->stream) {
+        itr = arglist_iterator_create(cmd->arglist);
         while ((arg = arglist_next(itr))) {
+            if (arg->reported)
+                continue;
             _client_printf(c, CP_INFO_XSTATUS, arg->node,
                     arg->state == ST_ON ? "on"
                     : arg->state == ST_OFF ? "off" : "unknown");
@@ -401,67 +848,82 @@ static void _client_query_status_reply(Client * c, bool error)
 
     } else {
         char *on, *off, *unknown;
-        hostlist_t hl_on, hl_off, hl_unknown;
+        hostbits_t hb_on, hb_off, hb_unknown;
 
-        hl_on = hostlist_create(NULL);
-        hl_off = hostlist_create(NULL);
-        hl_unknown = hostlist_create(NULL);
+        /* hostbits keep these sorted and unique as they are built */
+        hb_on = hostbits_create(NULL);
+        hb_off = hostbits_create(NULL);
+        hb_unknown = hostbits_create(NULL);
+        if (!hb_on || !hb_off || !hb_unknown)
+            err_exit(FALSE, "hostbits_create failed");
 
-        itr = arglist_iterator_create(c->cmd->arglist);
+        itr = arglist_iterator_create(cmd->arglist);
         while ((arg = arglist_next(itr))) {
             switch (arg->state) {
                 case ST_UNKNOWN:
-                    hostlist_push(hl_unknown, arg->node);
+                    hostbits_insert_host(hb_unknown, arg->node);
                     break;
                 case ST_ON:
-                    hostlist_push(hl_on, arg->node);
+                    hostbits_insert_host(hb_on, arg->node);
                     break;
                 case ST_OFF:
-                    hostlist_push(hl_off, arg->node);
+                    hostbits_insert_host(hb_off, arg->node);
                     break;
             }
         }
         arglist_iterator_destroy(itr);
 
-        hostlist_sort(hl_unknown);
-        hostlist_sort(hl_on);
-        hostlist_sort(hl_off);
+        unknown = hostbits_ranged_string_malloc(hb_unknown);
+        on      = hostbits_ranged_string_malloc(hb_on);
+        off     = hostbits_ranged_string_malloc(hb_off);
+        if (!unknown || !on || !off)
+            err_exit(FALSE, "hostbits_ranged_string_malloc failed");
 
-        unknown = _xhostlist_ranged_string(hl_unknown);
-        on      = _xhostlist_ranged_string(hl_on);
-        off     = _xhostlist_ranged_string(hl_off);
-
-        hostlist_destroy(hl_unknown);
-        hostlist_destroy(hl_on);
-        hostlist_destroy(hl_off);
+        hostbits_destroy(hb_unknown);
+        hostbits_destroy(hb_on);
+        hostbits_destroy(hb_off);
 
         _client_printf(c, CP_INFO_STATUS, on, off, unknown);
 
-        xfree (unknown);
-        xfree (on);
-        xfree (off);
+        free (unknown);
+        free (on);
+        free (off);
     }
+    _client_reply_done(c, cmd, TRUE);
+}
 
-    if (error)
-        _client_printf(c, CP_ERR_QRY_COMPLETE);
-    else
-        _client_printf(c, CP_RSP_QRY_COMPLETE);
+/*
+ * Send the per-node outcome of a power control command.
+ */
+static void _client_command_reply_json(Client * c, Command * cmd)
+{
+    Arg *arg;
+    ArgListIterator itr;
+
+    itr = arglist_iterator_create(cmd->arglist);
+    while ((arg = arglist_next(itr)))
+        _client_json_arg(c, cmd, arg);
+    arglist_iterator_destroy(itr);
 }
 
 /*
  * Reply to client request for temperature/beacon status.
  */
-static void _client_query_status_reply_nointerp(Client * c, bool error)
+static void _client_query_status_reply_nointerp(Client * c, Command * cmd)
 {
     Arg *arg;
     ArgListIterator itr;
     hostlist_t hl = hostlist_create(NULL);
     char *tmpstr;
 
-    assert(c->cmd != NULL);
-
-    itr = arglist_iterator_create(c->cmd->arglist);
+    itr = arglist_iterator_create(cmd->arglist);
     while ((arg = arglist_next(itr))) {
+        if (arg->reported)
+            continue;
+        if (cmd->json) {
+            _client_json_arg(c, cmd, arg);
+            continue;
+        }
         _client_printf(c, CP_INFO_XSTATUS, arg->node, arg->val);
         if (!arg->val)
             hostlist_push(hl, arg->node);
@@ -470,30 +932,44 @@ static void _client_query_status_reply_nointerp(Client * c, bool error)
 
     if (!hostlist_is_empty(hl)) {
         hostlist_sort(hl);
-        tmpstr = _xhostlist_ranged_string(hl);
+        if ((tmpstr = hostlist_ranged_string_malloc(hl)) == NULL)
+            err_exit(FALSE, "hostlist_ranged_string_malloc failed");
         _client_printf(c, CP_INFO_XSTATUS, tmpstr, "unknown");
-        xfree (tmpstr);
+        free (tmpstr);
     }
-    if (error)
-        _client_printf(c, CP_ERR_QRY_COMPLETE);
-    else
-        _client_printf(c, CP_RSP_QRY_COMPLETE);
+    _client_reply_done(c, cmd, TRUE);
     hostlist_destroy(hl);
 }
 
 /*
- * Create Command.
- * On error, return an error to the client and NULL to the caller.
+ * Get a Command from the pool and initialize it for client 'c'.
  */
-static Command *_create_command(Client * c, int com, char *arg1)
+static Command *_init_command(Client * c, int com)
 {
-    Command *cmd = (Command *) xmalloc(sizeof(Command));
+    Command *cmd = (Command *) pool_get(cli_command_pool);
 
+    cmd->id = _next_cmd_id();
+    cmd->client = c;
+    cmd->tag = c->tag ? arena_strdup(cmd->arena, c->tag) : NULL;
     cmd->com = com;
     cmd->error = FALSE;
     cmd->pending = 0;
     cmd->hl = NULL;
     cmd->arglist = NULL;
+    cmd->batch = NULL;
+    cmd->parts = NULL;
+    cmd->replied = FALSE;
+    cmd->json = c->json;
+    return cmd;
+}
+
+/*
+ * Create Command.
+ * On error, return an error to the client and NULL to the caller.
+ */
+static Command *_create_command(Client * c, int com, char *arg1)
+{
+    Command *cmd = _init_command(c, com);
 
     if (arg1) {
         /* Note: this can send CP_ERR_HOSTLIST to client */
@@ -527,16 +1003,202 @@ static Command *_create_command(Client * c, int com, char *arg1)
     return cmd;
 }
 
+/*
+ * Helper for _create_batch that parses one part of a batch request,
+ * copying its nodes to 'arg'.  Return its script index, or -1 if it is
+ * not a request that can be batched.
+ */
+static int _parse_batch_part(char *str, char *arg)
+{
+    static struct {
+        char *fmt;
+        int com;
+    } coms[] = {
+        { CP_ON,            PM_POWER_ON },
+        { CP_OFF,           PM_POWER_OFF },
+        { CP_CYCLE,         PM_POWER_CYCLE },
+        { CP_RESET,         PM_RESET },
+        { CP_BEACON_ON,     PM_BEACON_ON },
+        { CP_BEACON_OFF,    PM_BEACON_OFF },
+        { CP_STATUS,        PM_STATUS_PLUGS },
+        { CP_TEMP,          PM_STATUS_TEMP },
+        { CP_BEACON,        PM_STATUS_BEACON },
+    };
+    int i;
+
+    for (i = 0; i < sizeof(coms) / sizeof(coms[0]); i++) {
+        if (sscanf(str, coms[i].fmt, arg) == 1)
+            return coms[i].com;
+    }
+    return -1;
+}
+
+/*
+ * Create a batch Command from the ';' separated requests in 'str'.
+ * Every node is validated before any part is accepted, so the client
+ * hears about all bad nodes at once, and adjacent parts with the same
+ * command are merged into one.
+ * On error, return an error to the client and NULL to the caller.
+ */
+static Command *_create_batch(Client * c, char *str)
+{
+    Command *batch = _init_command(c, CMD_BATCH);
+    Command *part, *prev = NULL;
+    hostbits_t hb = NULL;
+    ListIterator itr;
+    hostlist_t hl;
+    char arg[CP_LINEMAX];
+    char *s, *saveptr;
+    int com;
+
+    batch->parts = list_create(NULL);
+    if ((hb = hostbits_create(NULL)) == NULL) {
+        _internal_error_response(c);
+        goto error;
+    }
+    for (s = strtok_r(str, CP_BATCH_SEP, &saveptr); s != NULL;
+            s = strtok_r(NULL, CP_BATCH_SEP, &saveptr)) {
+        if ((com = _parse_batch_part(_strip_whitespace(s), arg)) == -1) {
+            _client_printf(c, CP_ERR_PARSE);
+            goto error;
+        }
+        if ((hl = _hostlist_create_expanded(c, arg)) == NULL)
+            goto error;
+        if (hostbits_insert_list(hb, hl) < 0) {
+            _internal_error_response(c);
+            hostlist_destroy(hl);
+            goto error;
+        }
+        if (prev && prev->com == com) {
+            hostlist_push_list(prev->hl, hl);
+            hostlist_uniq(prev->hl);
+            hostlist_destroy(hl);
+            continue;
+        }
+        part = _init_command(c, com);
+        part->hl = hl;
+        part->batch = batch;
+        list_append(batch->parts, part);
+        prev = part;
+    }
+    if (list_is_empty(batch->parts)) {
+        _client_printf(c, CP_ERR_PARSE);
+        goto error;
+    }
+    if (!_hostbits_validate(c, hb))
+        goto error;
+
+    /* see NOTEs in _create_command() */
+    itr = list_iterator_create(batch->parts);
+    while ((part = list_next(itr))) {
+        if (!dev_check_actions(part->com, part->hl)) {
+            _client_printf(c, CP_ERR_UNIMPL);
+            break;
+        }
+        if ((part->arglist = arglist_create(part->hl)) == NULL) {
+            _internal_error_response(c);
+            break;
+        }
+    }
+    list_iterator_destroy(itr);
+    if (part != NULL)
+        goto error;
+    hostbits_destroy(hb);
+    return batch;
+error:
+    if (hb)
+        hostbits_destroy(hb);
+    _destroy_command(batch);
+    return NULL;
+}
+
+/*
+ * Enqueue device actions for all the parts of a batch at once.
+ * Return the number of parts with actions pending.
+ */
+static int _enqueue_batch(Client * c, Command * batch)
+{
+    int nparts = list_count(batch->parts);
+    BatchPart *bp = (BatchPart *) xmalloc(nparts * sizeof(BatchPart));
+    ListIterator itr;
+    Command *part;
+    int i;
+
+    itr = list_iterator_create(batch->parts);
+    for (i = 0; (part = list_next(itr)); i++) {
+        bp[i].com = part->com;
+        bp[i].hl = part->hl;
+        bp[i].cmd_id = part->id;
+        bp[i].arglist = part->arglist;
+    }
+    dev_enqueue_batch(bp, nparts, _act_finish,
+            c->telemetry ? _telemetry_printf : NULL);
+    list_iterator_reset(itr);
+    for (i = 0; (part = list_next(itr)); i++) {
+        part->pending = bp[i].count;
+        if (part->pending > 0) {
+            batch->pending++;
+            if (!hash_insert(cli_cmds, &part->id, part))
+                err_exit(TRUE, "_enqueue_batch: hash_insert");
+        }
+    }
+    list_iterator_destroy(itr);
+    xfree(bp);
+    return batch->pending;
+}
+
+/*
+ * Cancel the device actions of a Command (or of the parts of a batch).
+ * Return the number cancelled.
+ */
+static int _cancel_command(Command * cmd)
+{
+    ListIterator itr;
+    Command *part;
+    int n = 0;
+
+    if (cmd->parts) {
+        itr = list_iterator_create(cmd->parts);
+        while ((part = list_next(itr)))
+            n += _cancel_command(part);
+        list_iterator_destroy(itr);
+    } else if (cmd->pending > 0)
+        n = dev_cancel_actions(cmd->id);
+    return n;
+}
+
 /*
  * Destroy a Command.
  */
 static void _destroy_command(Command * cmd)
 {
+    Command *part;
+
+    if (hash_find(cli_cmds, &cmd->id) == cmd)
+        hash_remove(cli_cmds, &cmd->id);
+    if (cmd->parts) {
+        while ((part = list_pop(cmd->parts)))
+            _destroy_command(part);
+        list_destroy(cmd->parts);
+    }
     if (cmd->hl)
         hostlist_destroy(cmd->hl);
     if (cmd->arglist)
         arglist_unlink(cmd->arglist);
-    xfree(cmd);
+    dbg(DBG_MEMORY, "_destroy_command: %d: %d allocations, %d from heap",
+            cmd->com, arena_allocs(cmd->arena),
+            arena_heap_allocs(cmd->arena));
+    arena_reset(cmd->arena);
+    pool_put(cli_command_pool, cmd);
+}
+
+/*
+ * Direct output to client 'c' to the response for command 'cmd', so it is
+ * tagged as the command's request was, or to no command if 'cmd' is NULL.
+ */
+static void _client_select(Client *c, Command *cmd)
+{
+    c->tag = cmd ? cmd->tag : NULL;
 }
 
 /* helper for _parse_input that deletes leading & trailing whitespace */
@@ -552,6 +1214,34 @@ static char *_strip_whitespace(char *str)
     return head;
 }
 
+/*
+ * Helper for _parse_input that copies the tag of a pipelined request to
+ * 'tag' and returns the rest of the request, or NULL if there is no tag.
+ */
+static char *_split_tag(char *str, char *tag)
+{
+    int len = 0;
+
+    while (str[len] && (isalnum(str[len]) || strchr("-_.", str[len])))
+        len++;
+    if (len == 0 || len > CP_TAGMAX || !isspace(str[len]))
+        return NULL;
+    memcpy(tag, str, len);
+    tag[len] = '\0';
+    return _strip_whitespace(str + len);
+}
+
+/* helpers for finding commands by id or tag */
+static int _match_command(Command *cmd, void *key)
+{
+    return (cmd->id == *(int *) key);
+}
+
+static int _match_tag(Command *cmd, void *key)
+{
+    return (cmd->tag && strcmp(cmd->tag, key) == 0);
+}
+
 /*
  * Parse a line of input and create a Command (and enqueue device actions)
  * if needed.
@@ -560,17 +1250,34 @@ static void _parse_input(Client * c, char *input)
 {
     char *str = _strip_whitespace(input);
     char arg1[CP_LINEMAX];
+    char tag[CP_TAGMAX + 1];
     Command *cmd = NULL;
 
     memset(arg1, 0, CP_LINEMAX);
 
+    if (c->pipeline) {
+        char *rest = _split_tag(str, tag);
+
+        if (rest == NULL) {
+            _client_printf(c, CP_ERR_PARSE);            /* error: no tag */
+            return;
+        }
+        c->tag = tag;
+        str = rest;
+    }
+
     /* NOTE: sscanf is safe because 'str' is guaranteed to be < CP_LINEMAX */
 
     if (strlen(str) >= CP_LINEMAX) {
         _client_printf(c, CP_ERR_TOOLONG);              /* error: too long */
-    } else if (c->cmd != NULL) {
+    } else if (!c->pipeline && !list_is_empty(c->cmds)) {
         _client_printf(c, CP_ERR_CLIBUSY);              /* error: busy */
         return;                                         /* no prompt */
+    } else if (c->pipeline && list_find_first(c->cmds,
+                                    (ListFindF) _match_tag, tag)) {
+        _client_printf(c, CP_ERR_TAGINUSE);             /* error: tag in use */
+    } else if (c->pipeline && list_count(c->cmds) >= CP_PIPELINE_MAX) {
+        _client_printf(c, CP_ERR_CLIBUSY);              /* error: busy */
     } else if (!strncasecmp(str, CP_HELP, strlen(CP_HELP))) {
         _client_printf(c, CP_INFO_HELP);                /* help */
         _client_printf(c, CP_RSP_QRY_COMPLETE);
@@ -582,10 +1289,21 @@ static void _parse_input(Client * c, char *input)
     } else if (!strncasecmp(str, CP_EXPRANGE, strlen(CP_EXPRANGE))) {
         c->exprange = !c->exprange;                     /* exprange */
         _client_printf(c, CP_RSP_EXPRANGE, c->exprange ? "ON" : "OFF");
+    } else if (!strncasecmp(str, CP_PIPELINE, strlen(CP_PIPELINE))) {
+        c->pipeline = !c->pipeline;                     /* pipeline */
+        _client_printf(c, CP_RSP_PIPELINE, c->pipeline ? "ON" : "OFF");
+    } else if (!strncasecmp(str, CP_STREAM, strlen(CP_STREAM))) {
+        c->stream = !c->stream;                         /* stream */
+        _client_printf(c, CP_RSP_STREAM, c->stream ? "ON" : "OFF");
+    } else if (!strncasecmp(str, CP_JSON, strlen(CP_JSON))) {
+        c->json = !c->json;                             /* json */
+        _client_printf(c, CP_RSP_JSON, c->json ? "ON" : "OFF");
     } else if (!strncasecmp(str, CP_QUIT, strlen(CP_QUIT))) {
         c->client_quit = TRUE;
         _client_printf(c, CP_RSP_QUIT);                 /* quit */
         _handle_write(c);
+    } else if (sscanf(str, CP_BATCH, arg1) == 1) {      /* batch requests */
+        cmd = _create_batch(c, arg1);
     } else if (sscanf(str, CP_ON, arg1) == 1) {         /* on hostlist */
         cmd = _create_command(c, PM_POWER_ON, arg1);
     } else if (sscanf(str, CP_OFF, arg1) == 1) {        /* off hostlist */
@@ -619,58 +1337,150 @@ static void _parse_input(Client * c, char *input)
     }
 
     /* enqueue device actions and tie up the client if necessary */
-    if (cmd) {
+    if (cmd && cmd->parts) {
+        dbg(DBG_CLIENT, "_parse_input: enqueuing batch actions");
+        if (_enqueue_batch(c, cmd) == 0) {
+            _client_printf(c, CP_ERR_UNIMPL);
+            _destroy_command(cmd);
+            cmd = NULL;
+        } else
+            list_append(c->cmds, cmd);
+    } else if (cmd) {
         assert(cmd->hl != NULL);
         dbg(DBG_CLIENT, "_parse_input: enqueuing actions");
         cmd->pending = dev_enqueue_actions(cmd->com, cmd->hl, _act_finish,
                 c->telemetry ? _telemetry_printf : NULL,
-                c->client_id, cmd->arglist);
+                cmd->id, cmd->arglist);
         if (cmd->pending == 0) {
             _client_printf(c, CP_ERR_UNIMPL);
             _destroy_command(cmd);
             cmd = NULL;
+        } else {
+            list_append(c->cmds, cmd);
+            if (!hash_insert(cli_cmds, &cmd->id, cmd))
+                err_exit(TRUE, "_parse_input: hash_insert");
         }
-        assert(c->cmd == NULL);
-        c->cmd = cmd;
     }
+    c->tag = NULL;
 
-    /* reissue prompt if we didn't queue up any device actions */
-    if (cmd == NULL && !c->client_quit)
+    /* reissue prompt if no device actions are outstanding */
+    if (!c->pipeline && list_is_empty(c->cmds) && !c->client_quit)
         _client_printf(c, CP_PROMPT);
 }
 
+/*
+ * Find a command in progress by id.
+ * Return NULL if it is gone (e.g. its client disconnected).
+ */
+static Command *_find_command(int id)
+{
+    return hash_find(cli_cmds, &id);
+}
+
 /*
  * Callback for device debugging printfs (sent to client if --telemetry)
  */
-static void _telemetry_printf(int client_id, const char *fmt, ...)
+static void _telemetry_printf(int cmd_id, const char *fmt, ...)
 {
     va_list ap;
-    Client *c;
+    Command *cmd;
     char *str;
 
-    if ((c = _find_client(client_id))) {
+    if ((cmd = _find_command(cmd_id))) {
         va_start(ap, fmt);
         str = hvsprintf(fmt, ap);
         va_end(ap);
-        _client_printf(c, CP_INFO_TELEMETRY, str);
+        _client_select(cmd->client, cmd);
+        _client_printf(cmd->client, CP_INFO_TELEMETRY, str);
+        _client_select(cmd->client, NULL);
         xfree(str);
     }
 }
 
+/*
+ * Send the reply to a command whose actions have all completed.
+ */
+static void _client_command_reply(Client * c, Command * cmd)
+{
+    switch (cmd->com) {
+    case PM_STATUS_PLUGS:      /* status */
+    case PM_STATUS_BEACON:     /* beacon */
+        _client_query_status_reply(c, cmd);
+        break;
+    case PM_STATUS_TEMP:       /* temp */
+        _client_query_status_reply_nointerp(c, cmd);
+        break;
+    case PM_POWER_ON:          /* on */
+    case PM_POWER_OFF:         /* off */
+    case PM_BEACON_ON:         /* flash */
+    case PM_BEACON_OFF:        /* unflash */
+    case PM_POWER_CYCLE:       /* cycle */
+    case PM_RESET:             /* reset */
+        if (cmd->json)
+            _client_command_reply_json(c, cmd);
+        _client_reply_done(c, cmd, FALSE);
+        break;
+    default:
+        assert(FALSE);
+        _internal_error_response(c);
+        break;
+    }
+}
+
+/*
+ * A part of a batch has completed.  Send the replies of completed parts
+ * in order, up to the first one still in progress, and when every part
+ * is done, finish the batch with a single final line.
+ */
+static void _batch_reply(Client * c, Command * batch)
+{
+    ListIterator itr;
+    Command *part;
+    int id = batch->id;
+
+    itr = list_iterator_create(batch->parts);
+    while ((part = list_next(itr)) && part->pending == 0) {
+        if (part->replied)
+            continue;
+        _client_select(c, part);
+        _client_command_reply(c, part);
+        part->replied = TRUE;
+        if (part->error)
+            batch->error = TRUE;
+    }
+    list_iterator_destroy(itr);
+
+    if (--batch->pending > 0) {
+        _client_select(c, NULL);
+        return;
+    }
+    _client_select(c, batch);
+    _client_printf(c, batch->error ? CP_ERR_COM_COMPLETE
+                                   : CP_RSP_COM_COMPLETE);
+
+    /* clean up and re-prompt */
+    _client_select(c, NULL);
+    list_delete_all(c->cmds, (ListFindF) _match_command, &id);
+    if (!c->pipeline && list_is_empty(c->cmds))
+        _client_printf(c, CP_PROMPT);
+}
+
 /*
  * Callback for device action completion.
  */
-static void _act_finish(int client_id, ActError acterr, const char *fmt, ...)
+static void _act_finish(int cmd_id, ActError acterr, const char *fmt, ...)
 {
     va_list ap;
+    Command *cmd;
     Client *c;
     char *str;
 
     /* if client has gone away do nothing */
-    if (!(c = _find_client(client_id)))
+    if (!(cmd = _find_command(cmd_id)))
         return;
+    c = cmd->client;
     assert(c->magic == CLI_MAGIC);
-    assert(c->cmd != NULL);
+    _client_select(c, cmd);
 
     /* handle errors immediately */
     if (acterr != ACT_ESUCCESS) {
@@ -680,41 +1490,33 @@ static void _act_finish(int client_id, ActError acterr, const char *fmt, ...)
         _client_printf(c, CP_INFO_ACTERROR, str);
         xfree(str);
 
-        c->cmd->error = TRUE;       /* when done say "completed with errors" */
+        cmd->error = TRUE;          /* when done say "completed with errors" */
     }
 
-    /* all actions have called back - return response to client */
-    if (--c->cmd->pending == 0) {
-        switch (c->cmd->com) {
-        case PM_STATUS_PLUGS:      /* status */
-        case PM_STATUS_BEACON:     /* beacon */
-            _client_query_status_reply(c, c->cmd->error);
-            break;
-        case PM_STATUS_TEMP:       /* temp */
-            _client_query_status_reply_nointerp(c, c->cmd->error);
-            break;
-        case PM_POWER_ON:          /* on */
-        case PM_POWER_OFF:         /* off */
-        case PM_BEACON_ON:         /* flash */
-        case PM_BEACON_OFF:        /* unflash */
-        case PM_POWER_CYCLE:       /* cycle */
-        case PM_RESET:             /* reset */
-            if (c->cmd->error)
-                _client_printf(c, CP_ERR_COM_COMPLETE);
-            else
-                _client_printf(c, CP_RSP_COM_COMPLETE);
-            break;
-        default:
-            assert(FALSE);
-            _internal_error_response(c);
+    /* stream results from this device while others are still working */
+    if (c->stream && cmd->pending > 1 && !cmd->batch) {
+        switch (cmd->com) {
+        case PM_STATUS_PLUGS:
+        case PM_STATUS_BEACON:
+        case PM_STATUS_TEMP:
+            _client_query_stream_reply(c, cmd);
             break;
         }
+    }
+
+    /* all actions have called back - return response to client */
+    if (--cmd->pending == 0 && cmd->batch) {
+        _batch_reply(c, cmd->batch);
+    } else if (cmd->pending == 0) {
+        _client_command_reply(c, cmd);
 
         /* clean up and re-prompt */
-        _destroy_command(c->cmd);
-        c->cmd = NULL;
-        _client_printf(c, CP_PROMPT);
-    }
+        _client_select(c, NULL);
+        list_delete_all(c->cmds, (ListFindF) _match_command, &cmd_id);
+        if (!c->pipeline && list_is_empty(c->cmds))
+            _client_printf(c, CP_PROMPT);
+    } else
+        _client_select(c, NULL);
 }
 
 /*
@@ -722,6 +1524,8 @@ static void _act_finish(int client_id, ActError acterr, const char *fmt, ...)
  */
 static void _destroy_client(Client *c)
 {
+    Command *cmd;
+
     assert(c->magic == CLI_MAGIC);
 
     if (c->fd != NO_FD) {
@@ -737,34 +1541,26 @@ static void _destroy_client(Client *c)
         c->ofd = NO_FD;
     }
     if (c->to)
-        cbuf_destroy(c->to);
+        _put_cbuf(c->to);
     if (c->from)
-        cbuf_destroy(c->from);
-    if (c->cmd)
-        _destroy_command(c->cmd);
+        _put_cbuf(c->from);
+    while ((cmd = list_pop(c->cmds))) {
+        int n = _cancel_command(cmd);
+
+        if (n > 0)
+            dbg(DBG_CLIENT, "_destroy_client: cancelled %d actions", n);
+        _destroy_command(cmd);
+    }
     if (c->ip)
         xfree(c->ip);
     if (c->host)
         xfree(c->host);
-    xfree(c);
+    c->magic = 0;
+    pool_put(cli_client_pool, c);
     if (one_client)
         server_done = TRUE;
 }
 
-/* helper for _find_client */
-static int _match_client(Client *c, void *key)
-{
-    return (c->client_id == *(int *) key);
-}
-
-/*
- * Test if a client still exists (by sequence).
- */
-static Client *_find_client(int seq)
-{
-    return list_find_first(cli_clients, (ListFindF) _match_client, &seq);
-}
-
 /*
  * Begin listening for clients on configured listen addresses.
  * This function leaves listen_fds[] (of size listen_fds_len) initialized
@@ -873,14 +1669,18 @@ static void _create_client_socket(int fd)
     int error;
 
     /* create client data structure */
-    c = (Client *) xmalloc(sizeof(Client));
+    c = (Client *) pool_get(cli_client_pool);
     c->magic = CLI_MAGIC;
     c->to = NULL;
     c->from = NULL;
-    c->cmd = NULL;
-    c->client_id = _next_cli_id();
+    c->ip = NULL;
+    c->host = NULL;
+    c->tag = NULL;
     c->telemetry = FALSE;
     c->exprange = FALSE;
+    c->pipeline = FALSE;
+    c->stream = FALSE;
+    c->json = FALSE;
     c->ofd = NO_FD;
     c->client_quit = FALSE;
 
@@ -929,8 +1729,8 @@ static void _create_client_socket(int fd)
 #endif
 
     /* create I/O buffers */
-    c->to = cbuf_create(MIN_CLIENT_BUF, MAX_CLIENT_BUF);
-    c->from = cbuf_create(MIN_CLIENT_BUF, MAX_CLIENT_BUF);
+    c->to = _get_cbuf(CBUF_NO_DROP);
+    c->from = _get_cbuf(CBUF_WRAP_MANY);
 
     nonblock_set(c->fd);
 
@@ -951,20 +1751,22 @@ static void _create_client_stdio(void)
     Client *c;
 
     /* create client data structure */
-    c = (Client *) xmalloc(sizeof(Client));
+    c = (Client *) pool_get(cli_client_pool);
     c->magic = CLI_MAGIC;
-    c->cmd = NULL;
-    c->client_id = _next_cli_id();
+    c->tag = NULL;
     c->telemetry = FALSE;
     c->exprange = FALSE;
+    c->pipeline = FALSE;
+    c->stream = FALSE;
+    c->json = FALSE;
     c->client_quit = FALSE;
     c->fd = STDIN_FILENO;
     c->ofd = STDOUT_FILENO;
     c->host = xstrdup("localhost");
     c->ip = xstrdup("127.0.0.1"); /* XXX lies */
     c->port = 0;
-    c->to = cbuf_create(MIN_CLIENT_BUF, MAX_CLIENT_BUF);
-    c->from = cbuf_create(MIN_CLIENT_BUF, MAX_CLIENT_BUF);
+    c->to = _get_cbuf(CBUF_NO_DROP);
+    c->from = _get_cbuf(CBUF_WRAP_MANY);
 
     nonblock_set(c->fd);
     nonblock_set(c->ofd);
@@ -1017,14 +1819,30 @@ static void _handle_write(Client * c)
         err(TRUE, "write error on client");
         c->client_quit = TRUE;
     }
+    /* give back a buffer grown for a large reply once it is sent */
+    else if (cbuf_is_empty(c->to) && cbuf_size(c->to) > MAX_CLIENT_BUF) {
+        _put_cbuf(c->to);
+        c->to = _get_cbuf(CBUF_NO_DROP);
+    }
+}
+
+/*
+ * Return TRUE if the client has not read enough of its replies for new
+ * requests to be taken.  Requests are left unparsed (and the socket
+ * unread) until the output drains.
+ */
+static bool _client_backlogged(Client *c)
+{
+    return cbuf_used(c->to) > MAX_CLIENT_BACKLOG;
 }
 
 static void _handle_input(Client *c)
 {
     char buf[MAX_CLIENT_BUF];
-    int len;
+    int len = 0;
 
-    while ((len = cbuf_read_line(c->from, buf, sizeof(buf), 1)) > 0)
+    while (!_client_backlogged(c)
+            && (len = cbuf_read_line(c->from, buf, sizeof(buf), 1)) > 0)
         _parse_input(c, buf);
     if (len < 0)
         err(TRUE, "client cbuf_read_line returned %d", len);
@@ -1050,10 +1868,12 @@ void cli_pre_poll(xpollfd_t pfd)
         if (client->fd < 0)
             continue;
 
-        /* always set read set bits so select will unblock if the
-         * connection is dropped.
+        /* set read set bits so select will unblock if the connection
+         * is dropped, unless the client is backlogged: then input is
+         * left unread, and a dropped connection shows up on write.
          */
-        xpollfd_set(pfd, client->fd, XPOLLIN);
+        if (!_client_backlogged(client))
+            xpollfd_set(pfd, client->fd, XPOLLIN);
 
         /* need to be in the write set if we are sending anything */
         if (!cbuf_is_empty(client->to)) {
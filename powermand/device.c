@@ -33,7 +33,8 @@
  * list.
  *
  * client - calls dev_enqueue_actions() to cause one type of script to
- * run across possibly multiple devices.  This function returns an "action
+ * run across possibly multiple devices, or dev_enqueue_batch() to do the
+ * same for several commands at once.  This function returns an "action
  * count", and each time an action completes, a callback is made to the client
  * which decrements its count.  When the count reaches zero, the client knows
  * this module is all done operating on its behalf and can respond to the
@@ -61,6 +62,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
 #include <unistd.h>
@@ -68,9 +70,13 @@
 
 #include "list.h"
 #include "hostlist.h"
+#include "hash.h"
 #include "cbuf.h"
 #include "xtypes.h"
 #include "parse_util.h"
+#include "intern.h"
+#include "arena.h"
+#include "pool.h"
 #include "xpoll.h"
 #include "xmalloc.h"
 #include "xregex.h"
@@ -81,7 +87,6 @@
 #include "error.h"
 #include "debug.h"
 #include "client_proto.h"
-#include "hprintf.h"
 #include "xtime.h"
 
 /* ExecCtx's are the state for the execution of a block of statements.
@@ -100,8 +105,12 @@ typedef struct {
 /* Actions are queued on a device and executed one at a time.  Each action
  * represents a request to run a particular script on a device, for a set of
  * plugs.  Actions can be enqueued by the client or internally (e.g. login).
+ * Temporaries used while executing the script, including the ExecCtx's,
+ * come from the action's arena and are all released when it completes.
  */
 #define ACT_MAGIC 0xb00bb000
+#define ACT_ARENA_CHUNK 1024
+#define ACT_POOL_MAX 64
 #define MAX_LEVELS 2
 typedef struct {
     int magic;
@@ -109,11 +118,13 @@ typedef struct {
     List exec;                  /* stack of ExecCtxs (outer block is first) */
     ActionCB complete_fun;      /* callback for action completion */
     VerbosePrintf vpf_fun;      /* callback for device telemetry */
-    int client_id;              /* client id so completion can find client */
+    int cmd_id;                 /* command id so completion can find it */
     ActError errnum;            /* errno for action */
     struct timeval time_stamp;  /* time stamp for timeouts */
     struct timeval delay_start; /* time stamp for delay completion */
     ArgList arglist;            /* argument for query actions (list of Arg's) */
+    bool retried;               /* action has been retried after a timeout */
+    Arena arena;                /* temporaries for this action */
 } Action;
 
 
@@ -134,26 +145,55 @@ static bool _timeout(struct timeval *timestamp, struct timeval *timeout,
                      struct timeval *timeleft);
 static int _get_all_script(Device * dev, int com);
 static int _get_ranged_script(Device * dev, int com);
-static int _enqueue_actions(Device * dev, int com, hostlist_t hl,
+static int _enqueue_actions(Device * dev, int com, hash_t targets,
                             ActionCB complete_fun, VerbosePrintf vpf_fun,
-                            int client_id, ArgList arglist);
+                            int cmd_id, ArgList arglist);
 static Action *_create_action(Device * dev, int com, List plugs,
                               ActionCB complete_fun, VerbosePrintf vpf_fun,
-                              int client_id, ArgList arglist);
-static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
+                              int cmd_id, ArgList arglist);
+static int _enqueue_targetted_actions(Device * dev, int com, hash_t targets,
                                       ActionCB complete_fun,
                                       VerbosePrintf vpf_fun,
-                                      int client_id, ArgList arglist);
+                                      int cmd_id, ArgList arglist);
 static char *_getregex_buf(cbuf_t b, xregex_t re, xregex_match_t xm);
-static bool _command_needs_device(Device * dev, hostlist_t hl);
+static void _index_nodes(void);
+static hash_t _target_devices(hostlist_t hl);
 static void _enqueue_ping(Device * dev, struct timeval *timeout);
 static void _enqueue_login(Device *dev);
 static void _disconnect(Device * dev);
 static bool _connect(Device * dev);
 static bool _reconnect(Device * dev, struct timeval *timeout);
 static bool _time_to_reconnect(Device * dev, struct timeval *timeout);
+static bool _check_idle(Device * dev, struct timeval *timeout);
+static void _act_completion(Action *act, Device *dev);
 
 static List dev_devices = NULL;
+static List dev_devices_old = NULL;     /* running devices during reload */
+static hash_t dev_nodes = NULL;         /* interned node -> NodeRoute index */
+static Pool dev_act_pool = NULL;        /* released Actions */
+static hash_t dev_cmds = NULL;          /* command id -> CmdActions */
+
+/*
+ * The devices a client command has actions queued on, so that they can
+ * be cancelled without searching every device's queue.  An entry lives
+ * until the last of the command's actions is destroyed.
+ */
+#define DEV_CMD_HASH_SIZE 1024
+typedef struct {
+    int cmd_id;
+    int count;                  /* actions not yet destroyed */
+    List devs;                  /* devices they were queued on */
+    Device *last;               /* device last added to devs */
+} CmdActions;
+
+/*
+ * Node names are unique in the config, so each one is found on exactly
+ * one plug of one device.
+ */
+typedef struct {
+    Device *dev;
+    Plug *plug;
+} NodeRoute;
 static bool short_circuit_delay = FALSE;
 
 static void _dbg_actions(Device * dev)
@@ -225,9 +265,19 @@ static char *_getregex_buf(cbuf_t b, xregex_t re, xregex_match_t xm)
     return str;
 }
 
-static ExecCtx *_create_exec_ctx(Device *dev, List block, List plugs)
+/*
+ * Like dbg_memstr() but allocate the string from the action's arena.
+ */
+static char *_memstr(Action *act, char *mem, int len)
+{
+    char *str = arena_alloc(act->arena, DBG_MEMSTR_SIZE(len));
+
+    return dbg_memstr_buf(str, mem, len);
+}
+
+static ExecCtx *_create_exec_ctx(Action *act, List block, List plugs)
 {
-    ExecCtx *new = (ExecCtx *)xmalloc(sizeof(ExecCtx));
+    ExecCtx *new = (ExecCtx *)arena_alloc(act->arena, sizeof(ExecCtx));
 
     new->stmtitr = list_iterator_create(block);
     new->cur = list_next(new->stmtitr);
@@ -248,7 +298,7 @@ static void _destroy_exec_ctx(ExecCtx *e)
     if (e->plugs)
         list_destroy(e->plugs);
     e->plugs = NULL;
-    xfree(e);
+    /* memory is released with the action's arena */
 }
 
 static void _rewind_action(Action *act)
@@ -263,69 +313,274 @@ static void _rewind_action(Action *act)
         }
         _destroy_exec_ctx(e);
     }
-    /* reset outer block iterator and current pointer */
+    /* reset outer block iterator, current pointer, and stmt state */
     if (e) {
         list_iterator_reset(e->stmtitr);
         e->cur = list_next(e->stmtitr);
+        if (e->plugitr) {
+            pluglist_iterator_destroy(e->plugitr);
+            e->plugitr = NULL;
+        }
+        e->processing = FALSE;
     }
 }
 
+/* PoolCreateF for dev_act_pool.  An Action keeps its (empty) ExecCtx stack
+ * and its arena while in the pool, so a reused Action's ExecCtx's and
+ * other temporaries come from the arena chunk retained by arena_reset().
+ */
+static Action *_alloc_action(void)
+{
+    Action *act = (Action *) xmalloc(sizeof(Action));
+
+    act->exec = list_create((ListDelF)_destroy_exec_ctx);
+    act->arena = arena_create(ACT_ARENA_CHUNK);
+    return act;
+}
+
+/* PoolDestroyF for dev_act_pool.
+ */
+static void _free_action(Action *act)
+{
+    list_destroy(act->exec);
+    arena_destroy(act->arena);
+    xfree(act);
+}
+
+/* key and compare functions for dev_cmds */
+static unsigned int _cmd_hash_key(const int *id)
+{
+    return (unsigned int)*id;
+}
+
+static int _cmd_hash_cmp(const int *id1, const int *id2)
+{
+    return (*id1 != *id2);
+}
+
+static void _cmd_destroy(CmdActions *ca)
+{
+    list_destroy(ca->devs);
+    xfree(ca);
+}
+
+/* Note that an action for command 'cmd_id' is being queued on 'dev'.
+ * A device's actions for a command are enqueued together, so checking
+ * the last device added is enough to keep 'devs' free of duplicates.
+ */
+static void _cmd_add_action(int cmd_id, Device *dev)
+{
+    CmdActions *ca = hash_find(dev_cmds, &cmd_id);
+
+    if (ca == NULL) {
+        ca = (CmdActions *) xmalloc(sizeof(CmdActions));
+        ca->cmd_id = cmd_id;
+        ca->count = 0;
+        ca->devs = list_create(NULL);
+        ca->last = NULL;
+        if (!hash_insert(dev_cmds, &ca->cmd_id, ca))
+            err_exit(TRUE, "_cmd_add_action: hash_insert");
+    }
+    ca->count++;
+    if (ca->last != dev) {
+        list_append(ca->devs, dev);
+        ca->last = dev;
+    }
+}
+
+/* Note that an action for command 'cmd_id' has been destroyed.
+ */
+static void _cmd_del_action(int cmd_id)
+{
+    CmdActions *ca = hash_find(dev_cmds, &cmd_id);
+
+    if (ca && --ca->count == 0)
+        _cmd_destroy(hash_remove(dev_cmds, &cmd_id));
+}
+
+/* helpers for dev_destroy - forget a device that is going away */
+static int _match_device(Device *dev, Device *key)
+{
+    return (dev == key);
+}
+
+static int _cmd_forget_device(CmdActions *ca, Device *dev)
+{
+    list_delete_all(ca->devs, (ListFindF) _match_device, dev);
+    if (ca->last == dev)
+        ca->last = NULL;
+    return 0;
+}
+
 static Action *_create_action(Device * dev, int com, List plugs,
                               ActionCB complete_fun, VerbosePrintf vpf_fun,
-                              int client_id, ArgList arglist)
+                              int cmd_id, ArgList arglist)
 {
     Action *act;
     ExecCtx *e;
 
     dbg(DBG_ACTION, "_create_action: %d", com);
-    act = (Action *) xmalloc(sizeof(Action));
+    act = (Action *) pool_get(dev_act_pool);
+    assert(list_is_empty(act->exec));
     act->magic = ACT_MAGIC;
     act->com = com;
     act->complete_fun = complete_fun;
     act->vpf_fun = vpf_fun;
-    act->client_id = client_id;
+    act->cmd_id = cmd_id;
 
-    act->exec = list_create((ListDelF)_destroy_exec_ctx);
-    e = _create_exec_ctx(dev, dev->scripts[act->com], plugs);
+    e = _create_exec_ctx(act, dev->scripts[act->com], plugs);
     list_push(act->exec, e);
 
     act->errnum = ACT_ESUCCESS;
     act->arglist = arglist ? arglist_link(arglist) : NULL;
+    act->retried = FALSE;
+    if (complete_fun)
+        _cmd_add_action(cmd_id, dev);
     timerclear(&act->time_stamp);
+    timerclear(&act->delay_start);
     return act;
 }
 
 static void _destroy_action(Action * act)
 {
+    ExecCtx *e;
+
     assert(act->magic == ACT_MAGIC);
     act->magic = 0;
     dbg(DBG_ACTION, "_destroy_action: %d", act->com);
-    if (act->exec)
-        list_destroy(act->exec);
-    act->exec = NULL;
+    if (act->complete_fun)
+        _cmd_del_action(act->cmd_id);
+    while ((e = list_pop(act->exec)))
+        _destroy_exec_ctx(e);
     if (act->arglist)
         arglist_unlink(act->arglist);
     act->arglist = NULL;
-    xfree(act);
+    dbg(DBG_MEMORY, "_destroy_action: %d: %d allocations, %d from heap",
+            act->com, arena_allocs(act->arena),
+            arena_heap_allocs(act->arena));
+    arena_reset(act->arena);
+    pool_put(dev_act_pool, act);
 }
 
 /* initialize this module */
 void dev_init(bool Sopt)
 {
     dev_devices = list_create((ListDelF) dev_destroy);
+    dev_act_pool = pool_create(ACT_POOL_MAX, (PoolCreateF)_alloc_action,
+                               (PoolDestroyF)_free_action);
+    dev_cmds = hash_create(DEV_CMD_HASH_SIZE, (hash_key_f)_cmd_hash_key,
+                           (hash_cmp_f)_cmd_hash_cmp,
+                           (hash_del_f)_cmd_destroy);
+    if (dev_cmds == NULL)
+        err_exit(TRUE, "hash_create");
     short_circuit_delay = Sopt;
 }
 
 /* tear down this module */
 void dev_fini(void)
 {
+    if (dev_nodes)
+        hash_destroy(dev_nodes);
+    dev_nodes = NULL;
     list_destroy(dev_devices);
+    hash_destroy(dev_cmds);
+    dev_cmds = NULL;
+    dbg(DBG_MEMORY, "dev_fini: %d actions, %d allocated",
+            pool_gets(dev_act_pool), pool_creates(dev_act_pool));
+    pool_destroy(dev_act_pool);
+    dev_act_pool = NULL;
+}
+
+/*
+ * Set aside the running devices so the config file parser can build a
+ * fresh device list (see conf_reload()).
+ */
+void dev_reload_begin(void)
+{
+    assert(dev_devices_old == NULL);
+    dev_devices_old = dev_devices;
+    dev_devices = list_create((ListDelF) dev_destroy);
+}
+
+/* helper for dev_reload_end */
+static void _reload_abort_actions(Device *dev)
+{
+    Action *act;
+
+    while ((act = list_dequeue(dev->acts)) != NULL) {
+        act->errnum = ACT_ERELOAD;
+        if (act->complete_fun)
+            _act_completion(act, dev);
+        _destroy_action(act);
+    }
+}
+
+/*
+ * Merge the newly parsed device list with the running devices.  A running
+ * device whose configuration is unchanged keeps its connection, login
+ * state, and action queue, and only adopts the new plug to node map.
+ * The old map is kept until queued actions that reference it are done.
+ * Devices that were removed or changed are destroyed, failing their
+ * queued actions, and new devices will be connected by dev_post_poll().
+ */
+void dev_reload_end(void)
+{
+    List devices = list_create((ListDelF) dev_destroy);
+    int kept = 0, added = 0, replaced = 0, removed = 0;
+    Device *dev, *old;
+    ListIterator itr;
+
+    assert(dev_devices_old != NULL);
+
+    while ((dev = list_pop(dev_devices))) {
+        itr = list_iterator_create(dev_devices_old);
+        old = list_find(itr, (ListFindF) _match_name, dev->name);
+        if (old)
+            list_remove(itr);
+        list_iterator_destroy(itr);
+
+        if (old && strcmp(old->signature, dev->signature) == 0) {
+            list_append(old->stale_plugs, old->plugs);
+            old->plugs = dev->plugs;
+            dev->plugs = NULL;
+            dev_destroy(dev);
+            list_append(devices, old);
+            kept++;
+        } else {
+            if (old) {
+                _reload_abort_actions(old);
+                dev_destroy(old);
+                replaced++;
+            } else
+                added++;
+            list_append(devices, dev);
+        }
+    }
+    while ((old = list_pop(dev_devices_old))) {
+        _reload_abort_actions(old);
+        dev_destroy(old);
+        removed++;
+    }
+    list_destroy(dev_devices);
+    list_destroy(dev_devices_old);
+    dev_devices_old = NULL;
+    dev_devices = devices;
+    if (dev_nodes)
+        hash_destroy(dev_nodes);
+    dev_nodes = NULL;
+    _index_nodes();                     /* queued actions need plug ids */
+
+    dbg(DBG_DEVICE, "reload: devices kept=%d added=%d replaced=%d removed=%d",
+        kept, added, replaced, removed);
 }
 
 /* add a device to the device list (called from config file parser) */
 void dev_add(Device * dev)
 {
     list_append(dev_devices, dev);
+    if (dev_nodes)
+        hash_destroy(dev_nodes);
+    dev_nodes = NULL;                   /* rebuilt on next use */
 }
 
 /*
@@ -432,22 +687,65 @@ static bool _reconnect(Device *dev, struct timeval *timeout)
     return connected;
 }
 
-/* helper for dev_check_actions/dev_enqueue_actions */
-static bool _command_needs_device(Device * dev, hostlist_t hl)
+/* Build the node name -> (Device, Plug) index if it is out of date,
+ * and give each plug the id of its node for arglist_find().
+ */
+static void _index_nodes(void)
 {
-    bool needed = FALSE;
-    PlugListIterator itr;
+    ListIterator itr;
+    PlugListIterator pitr;
+    Device *dev;
     Plug *plug;
+    NodeRoute *r;
 
-    itr = pluglist_iterator_create(dev->plugs);
-    while ((plug = pluglist_next(itr))) {
-        if (plug->node != NULL && hostlist_find(hl, plug->node) != -1) {
-            needed = TRUE;
-            break;
+    if (dev_nodes)
+        return;
+    dev_nodes = hash_create(hostlist_count(conf_getnodes()),
+                            (hash_key_f)intern_hash_key,
+                            (hash_cmp_f)intern_cmp, (hash_del_f)xfree);
+    itr = list_iterator_create(dev_devices);
+    while ((dev = list_next(itr))) {
+        pitr = pluglist_iterator_create(dev->plugs);
+        while ((plug = pluglist_next(pitr))) {
+            if (plug->node == NULL)
+                continue;
+            plug->nodeid = conf_node_id(plug->node);
+            r = (NodeRoute *)xmalloc(sizeof(NodeRoute));
+            r->dev = dev;
+            r->plug = plug;
+            if (!hash_insert(dev_nodes, plug->node, r))
+                xfree(r);                       /* not reached */
         }
+        pluglist_iterator_destroy(pitr);
     }
-    pluglist_iterator_destroy(itr);
-    return needed;
+    list_iterator_destroy(itr);
+}
+
+/*
+ * Helper for dev_check_actions/dev_enqueue_actions.  Look up each target
+ * node in the index and set dev->targetted on the devices that own them.
+ * Return the set of (interned) target node names.  Caller must clear
+ * dev->targetted and destroy the set.
+ */
+static hash_t _target_devices(hostlist_t hl)
+{
+    hostlist_iterator_t itr;
+    NodeRoute *r;
+    hash_t targets;
+    char *node;
+
+    _index_nodes();
+    targets = hash_create(hostlist_count(hl), (hash_key_f)intern_hash_key,
+                          (hash_cmp_f)intern_cmp, NULL);
+    if ((itr = hostlist_iterator_create(hl)) == NULL)
+        err_exit(FALSE, "hostlist_iterator_create failed");
+    while ((node = intern_hostlist_next(itr))) {
+        if ((r = hash_find(dev_nodes, node)))
+            r->dev->targetted = TRUE;
+        hash_insert(targets, node, node);       /* fails on duplicate */
+    }
+    hostlist_iterator_destroy(itr);
+    return targets;
 }
 
 /*
@@ -458,21 +756,23 @@ bool dev_check_actions(int com, hostlist_t hl)
 {
     Device *dev;
     ListIterator itr;
+    hash_t targets;
     bool valid = TRUE;
 
     assert(hl != NULL);
 
+    targets = _target_devices(hl);
     itr = list_iterator_create(dev_devices);
     while ((dev = list_next(itr))) {
-        if (_command_needs_device(dev, hl)) {
+        if (dev->targetted) {
             if (!dev->scripts[com] && _get_all_script(dev, com) == -1
-                                   && _get_ranged_script(dev, com) == -1)  {
+                                   && _get_ranged_script(dev, com) == -1)
                 valid = FALSE;
-                break;
-            }
+            dev->targetted = FALSE;
         }
     }
     list_iterator_destroy(itr);
+    hash_destroy(targets);
     return valid;
 }
 
@@ -482,35 +782,82 @@ bool dev_check_actions(int com, hostlist_t hl)
  * actions "check in".
  */
 int dev_enqueue_actions(int com, hostlist_t hl, ActionCB complete_fun,
-        VerbosePrintf vpf_fun, int client_id, ArgList arglist)
+        VerbosePrintf vpf_fun, int cmd_id, ArgList arglist)
+{
+    BatchPart part;
+
+    part.com = com;
+    part.hl = hl;
+    part.cmd_id = cmd_id;
+    part.arglist = arglist;
+    dev_enqueue_batch(&part, 1, complete_fun, vpf_fun);
+    return part.count;
+}
+
+/*
+ * Translate several commands into actions for devices in one pass over
+ * the devices.  Each device gets the actions for every part that targets
+ * it, in the order of the parts, so a device works through the whole
+ * batch in one go.  The action count for each part is set in its 'count'.
+ * Return the total.
+ */
+int dev_enqueue_batch(BatchPart *parts, int nparts, ActionCB complete_fun,
+        VerbosePrintf vpf_fun)
 {
     Device *dev;
     ListIterator itr;
+    hash_t *targets;
+    bool *involved;     /* involved[d * nparts + i]: device d in part i */
+    int ndevs = list_count(dev_devices);
     int total = 0;
+    int i, d;
 
+    targets = (hash_t *)xmalloc(nparts * sizeof(hash_t));
+    involved = (bool *)xmalloc((ndevs * nparts + 1) * sizeof(bool));
     itr = list_iterator_create(dev_devices);
-    while ((dev = list_next(itr))) {
-        int count;
-
-        if (!dev->scripts[com] && _get_all_script(dev, com) == -1
-                               && _get_ranged_script(dev, com) == -1)
-            continue;                               /* unimplemented script */
-        if (hl && !_command_needs_device(dev, hl))
-            continue;                               /* uninvolved device */
-        count = _enqueue_actions(dev, com, hl, complete_fun, vpf_fun,
-                client_id, arglist);
-        if (count > 0 && dev->connect_state != DEV_CONNECTED)
-            dev->retry_count = 0;   /* expedite retries on this device since */
-        total += count;             /*   the user is beating on us... */
+    for (i = 0; i < nparts; i++) {
+        parts[i].count = 0;
+        targets[i] = parts[i].hl ? _target_devices(parts[i].hl) : NULL;
+        list_iterator_reset(itr);
+        for (d = 0; (dev = list_next(itr)); d++) {
+            involved[d * nparts + i] = !parts[i].hl || dev->targetted;
+            dev->targetted = FALSE;
+        }
+    }
+
+    list_iterator_reset(itr);
+    for (d = 0; (dev = list_next(itr)); d++) {
+        for (i = 0; i < nparts; i++) {
+            int com = parts[i].com;
+            int count;
+
+            if (!involved[d * nparts + i])
+                continue;                           /* uninvolved device */
+            if (!dev->scripts[com] && _get_all_script(dev, com) == -1
+                                   && _get_ranged_script(dev, com) == -1)
+                continue;                           /* unimplemented script */
+            count = _enqueue_actions(dev, com, targets[i], complete_fun,
+                    vpf_fun, parts[i].cmd_id, parts[i].arglist);
+            if (count > 0 && dev->connect_state != DEV_CONNECTED)
+                dev->retry_count = 0;   /* expedite retries on this device */
+            parts[i].count += count;    /*   since the user is beating on us */
+            total += count;
+        }
     }
     list_iterator_destroy(itr);
 
+    for (i = 0; i < nparts; i++)
+        if (targets[i])
+            hash_destroy(targets[i]);
+    xfree(targets);
+    xfree(involved);
+
     return total;
 }
 
-static int _enqueue_actions(Device * dev, int com, hostlist_t hl,
+static int _enqueue_actions(Device * dev, int com, hash_t targets,
                             ActionCB complete_fun, VerbosePrintf vpf_fun,
-                            int client_id, ArgList arglist)
+                            int cmd_id, ArgList arglist)
 {
     Action *act;
     int count = 0;
@@ -524,13 +871,13 @@ static int _enqueue_actions(Device * dev, int com, hostlist_t hl,
             dbg(DBG_ACTION, "resetting iterator for non-login action");
         }
         act = _create_action(dev, com, NULL, complete_fun, vpf_fun,
-                client_id, arglist);
+                cmd_id, arglist);
         list_prepend(dev->acts, act);
         count++;
         break;
     case PM_LOG_OUT:
     case PM_PING:
-        act = _create_action(dev, com, NULL, complete_fun, vpf_fun, client_id,
+        act = _create_action(dev, com, NULL, complete_fun, vpf_fun, cmd_id,
                 arglist);
         list_append(dev->acts, act);
         count++;
@@ -545,8 +892,8 @@ static int _enqueue_actions(Device * dev, int com, hostlist_t hl,
     case PM_STATUS_PLUGS:
     case PM_STATUS_TEMP:
     case PM_STATUS_BEACON:
-        count += _enqueue_targetted_actions(dev, com, hl, complete_fun,
-                                                vpf_fun, client_id, arglist);
+        count += _enqueue_targetted_actions(dev, com, targets, complete_fun,
+                                                vpf_fun, cmd_id, arglist);
         break;
     default:
         assert(FALSE);
@@ -648,10 +995,10 @@ static bool _is_query_action(int com)
 }
 
 
-static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
+static int _enqueue_targetted_actions(Device * dev, int com, hash_t targets,
                                       ActionCB complete_fun,
                                       VerbosePrintf vpf_fun,
-                                      int client_id, ArgList arglist)
+                                      int cmd_id, ArgList arglist)
 {
     List new_acts = list_create((ListDelF) _destroy_action);
     bool all = TRUE;
@@ -662,7 +1009,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
     List ranged_plugs = NULL;
     int used_ranged_plugs = 0;
 
-    assert(hl != NULL);
+    assert(targets != NULL);
 
     if (!(ranged_plugs = list_create((ListDelF)NULL)))
         goto cleanup;
@@ -677,7 +1024,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
         }
 
         /* check if node name for plug matches the target */
-        if (hostlist_find(hl, plug->node) == -1) {
+        if (hash_find(targets, plug->node) == NULL) {
             all = FALSE;
             continue;
         }
@@ -697,7 +1044,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
             }
 
             act = _create_action(dev, com, plugs, complete_fun, vpf_fun,
-                        client_id, arglist);
+                        cmd_id, arglist);
             list_append(new_acts, act);
         }
     }
@@ -710,7 +1057,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
 
         if (ncom != -1) {
             act = _create_action(dev, ncom, NULL, complete_fun,
-                                 vpf_fun, client_id, arglist);
+                                 vpf_fun, cmd_id, arglist);
             list_append(dev->acts, act);
             count++;
         }
@@ -723,7 +1070,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
 
         if (ncom != -1) {
             act = _create_action(dev, ncom, ranged_plugs, complete_fun,
-                                 vpf_fun, client_id, arglist);
+                                 vpf_fun, cmd_id, arglist);
             list_append(dev->acts, act);
             used_ranged_plugs++;
             count++;
@@ -746,6 +1093,48 @@ cleanup:
     return count;
 }
 
+/*
+ * Cancel actions queued on behalf of a command whose client has gone away.
+ * Query actions that have not begun executing are discarded, since nobody
+ * is left to receive their results.  Control actions, and any action that
+ * has already started, are allowed to run to completion so a device is
+ * never abandoned in the middle of a power operation.
+ * Return the number of actions cancelled.
+ */
+int dev_cancel_actions(int cmd_id)
+{
+    CmdActions *ca;
+    Device *dev;
+    Action *act;
+    ListIterator itr, aitr;
+    int count = 0;
+
+    /* take the entry out first, as destroying actions would free it */
+    if (!(ca = hash_remove(dev_cmds, &cmd_id)))
+        return 0;
+    itr = list_iterator_create(ca->devs);
+    while ((dev = list_next(itr))) {
+        aitr = list_iterator_create(dev->acts);
+        while ((act = list_next(aitr))) {
+            if (act->cmd_id != cmd_id)
+                continue;
+            if (!_is_query_action(act->com))
+                continue;
+            if (timerisset(&act->time_stamp))   /* already started */
+                continue;
+            dbg(DBG_ACTION, "%s: cancelling action %d for command %d",
+                dev->name, act->com, cmd_id);
+            list_delete(aitr);
+            count++;
+        }
+        list_iterator_destroy(aitr);
+    }
+    list_iterator_destroy(itr);
+    _cmd_destroy(ca);
+
+    return count;
+}
+
 /* Called upon success of connect or finish_connect device methods.
  */
 static void _enqueue_login(Device *dev)
@@ -768,37 +1157,101 @@ static void _disconnect(Device * dev)
     /* update state */
     dev->connect_state = DEV_NOT_CONNECTED;
     dev->logged_in = FALSE;
+    dev->logging_out = FALSE;
 
-    /* delete PM_LOG_IN action queued for this device, if any */
-    if (((act = list_peek(dev->acts)) != NULL) && act->com == PM_LOG_IN)
+    /* delete PM_LOG_IN or PM_LOG_OUT action queued for this device, if any */
+    if (((act = list_peek(dev->acts)) != NULL)
+            && (act->com == PM_LOG_IN || act->com == PM_LOG_OUT))
         _destroy_action(list_dequeue(dev->acts));
 }
 
-static void _act_completion(Action *act, Device *dev)
+/* Describe an action error for the client.
+ */
+static const char *_act_errstr(ActError errnum)
 {
-    assert(act->complete_fun != NULL);
-
-    switch (act->errnum) {
+    switch (errnum) {
     case ACT_ECONNECTTIMEOUT:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: connect timeout", dev->name);
-        break;
+        return "connect timeout";
     case ACT_ELOGINTIMEOUT:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: login timeout", dev->name);
-        break;
+        return "login timeout";
     case ACT_EEXPFAIL:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: action timed out waiting for expected response", dev->name);
-        break;
+        return "action timed out waiting for expected response";
     case ACT_EABORT:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: action aborted due to previous action timeout", dev->name);
-        break;
+        return "action aborted due to previous action timeout";
+    case ACT_ERELOAD:
+        return "action aborted due to configuration reload";
     case ACT_ESUCCESS:
-        act->complete_fun(act->client_id, act->errnum, NULL);
         break;
     }
+    return NULL;
+}
+
+/* Report completion of an action.  On error, the cause is also recorded
+ * against the device's nodes in the arglist that have no result, so the
+ * client can say why each one is unknown.
+ */
+static void _act_completion(Action *act, Device *dev)
+{
+    const char *errstr = _act_errstr(act->errnum);
+
+    assert(act->complete_fun != NULL);
+
+    if (errstr == NULL) {
+        act->complete_fun(act->cmd_id, act->errnum, NULL);
+        return;
+    }
+    if (act->arglist) {
+        PlugListIterator itr = pluglist_iterator_create(dev->plugs);
+        Plug *plug;
+        Arg *arg;
+
+        while ((plug = pluglist_next(itr))) {
+            if (plug->node == NULL)
+                continue;
+            arg = arglist_find(act->arglist, plug->nodeid);
+            if (arg && arg->val == NULL && arg->error == NULL)
+                arg->error = errstr;
+        }
+        pluglist_iterator_destroy(itr);
+    }
+    act->complete_fun(act->cmd_id, act->errnum, "%s: %s", dev->name, errstr);
+}
+
+/*
+ * Helper for _process_action().  The action at the head of the device queue
+ * has timed out, and the device is about to be reconnected.  Rewind client
+ * actions on the queue so they run again once the device is logged in.
+ * Actions that have already been retried once, and internal actions, are
+ * completed with an error (the head's error, else ACT_EABORT) and dropped.
+ */
+static void _retry_actions(Device *dev)
+{
+    ListIterator itr;
+    Action *act;
+    bool head = TRUE;
+
+    itr = list_iterator_create(dev->acts);
+    while ((act = list_next(itr))) {
+        if (act->complete_fun && !act->retried) {
+            if (act->vpf_fun)
+                act->vpf_fun(act->cmd_id, "retry(%s): after reconnect",
+                        dev->name);
+            _rewind_action(act);
+            act->retried = TRUE;
+            act->errnum = ACT_ESUCCESS;
+            timerclear(&act->time_stamp);
+        } else {
+            if (!head)
+                act->errnum = ACT_EABORT;
+            if (act->complete_fun)
+                _act_completion(act, dev);
+            list_delete(itr);
+        }
+        head = FALSE;
+    }
+    list_iterator_destroy(itr);
+
+    dev->retry_count = 0;   /* expedite reconnect */
 }
 
 /*
@@ -837,15 +1290,14 @@ static void _process_action(Device * dev, struct timeval *timeout)
             if (act->vpf_fun) {
                 static char mem[MAX_DEV_BUF];
                 int len = cbuf_peek(dev->from, mem, MAX_DEV_BUF);
-                char *memstr = dbg_memstr(mem, len);
+                char *memstr = _memstr(act, mem, len);
 
                 if (!(dev->connect_state == DEV_CONNECTED))
-                    act->vpf_fun(act->client_id, "connect(%s): timeout",
+                    act->vpf_fun(act->cmd_id, "connect(%s): timeout",
                             dev->name);
                 else
-                    act->vpf_fun(act->client_id, "recv(%s): '%s'",
+                    act->vpf_fun(act->cmd_id, "recv(%s): '%s'",
                             dev->name, memstr);
-                xfree(memstr);
             }
 
         /* not connected but timeout not yet exceeded */
@@ -884,36 +1336,60 @@ static void _process_action(Device * dev, struct timeval *timeout)
 
             /* completed action successfully! */
             if (e == NULL) {
-                if (act->com == PM_LOG_IN)
+                int com = act->com;
+
+                if (com == PM_LOG_IN)
                     dev->logged_in = TRUE;
+                if (com == PM_LOG_OUT)
+                    dev->logged_in = FALSE;
+                if (com == PM_LOG_IN || act->complete_fun)
+                    if (gettimeofday(&dev->last_activity, NULL) < 0)
+                        err_exit(TRUE, "gettimeofday");
                 if (act->complete_fun)
                     _act_completion(act, dev);
                 _destroy_action(list_dequeue(dev->acts));
                 dev->stat_successful_actions++;
+
+                /* logged out - leave disconnect to _check_idle() */
+                if (com == PM_LOG_OUT)
+                    break;
             }
 
         /* most recently attempted stmt completed with error */
         } else {
             ActError res = act->errnum; /* save for ref after _destroy_action */
 
-            if (act->complete_fun)
-                _act_completion(act, dev);
-            _destroy_action(list_dequeue(dev->acts));
-
-            /* if one action failed, abort the rest in the device queue
-             * in preparation for reconnect.
+            /* if so configured, an expect timeout gets one retry after
+             * reconnect for the failed action and those queued behind it.
              */
-            while ((act = list_dequeue(dev->acts)) != NULL) {
-                act->errnum = (res == ACT_EEXPFAIL ? ACT_EABORT : res);
+            if (res == ACT_EEXPFAIL && conf_get_retry()) {
+                _retry_actions(dev);
+
+            } else {
                 if (act->complete_fun)
                     _act_completion(act, dev);
-                _destroy_action(act);
+                _destroy_action(list_dequeue(dev->acts));
+
+                /* if one action failed, abort the rest in the device queue
+                 * in preparation for reconnect.
+                 */
+                while ((act = list_dequeue(dev->acts)) != NULL) {
+                    act->errnum = (res == ACT_EEXPFAIL ? ACT_EABORT : res);
+                    if (act->complete_fun)
+                        _act_completion(act, dev);
+                    _destroy_action(act);
+                }
             }
 
-            /* reconnect/login if expect timed out */
+            /* reconnect/login if expect timed out (on demand devices
+             * only reconnect if there is something left to do).
+             */
             if ((dev->connect_state == DEV_CONNECTED)) {
                 dbg(DBG_DEVICE, "_process_action: disconnecting due to error");
-                _reconnect(dev, timeout);
+                if (dev->ondemand && list_is_empty(dev->acts))
+                    _disconnect(dev);
+                else
+                    _reconnect(dev, timeout);
                 break;
             }
         }
@@ -985,7 +1461,7 @@ static bool _process_foreach(Device *dev, Action *act, ExecCtx *e)
             goto cleanup;
         }
 
-        new = _create_exec_ctx(dev, e->cur->u.foreach.stmts, plugs);
+        new = _create_exec_ctx(act, e->cur->u.foreach.stmts, plugs);
         list_push(act->exec, new);
     } else {
         pluglist_iterator_destroy(e->plugitr);
@@ -1011,7 +1487,7 @@ static bool _process_ifonoff(Device *dev, Action *act, ExecCtx *e)
 
         if (e->plugs && list_count(e->plugs) > 0) {
             Plug *plug = list_peek(e->plugs);
-            Arg *arg = arglist_find(act->arglist, plug->node);
+            Arg *arg = arglist_find(act->arglist, plug->nodeid);
 
             if (arg)
                 state = arg->state;
@@ -1051,7 +1527,7 @@ static bool _process_ifonoff(Device *dev, Action *act, ExecCtx *e)
                 }
             }
 
-            new = _create_exec_ctx(dev, e->cur->u.ifonoff.stmts, plugs);
+            new = _create_exec_ctx(act, e->cur->u.ifonoff.stmts, plugs);
             list_push(act->exec, new);
             list_iterator_destroy(itr);
         }
@@ -1064,7 +1540,9 @@ static bool _process_ifonoff(Device *dev, Action *act, ExecCtx *e)
 static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
 {
     bool finished = TRUE;
+    const char *sub;
     char *plug_name = NULL;
+    int len;
 
     /*
      * Usage: setplugstate [plug] status [interps]
@@ -1072,22 +1550,25 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
      * (implying target plug name).
      */
     if (e->cur->u.setplugstate.plug_name)    /* literal */
-        plug_name = xstrdup(e->cur->u.setplugstate.plug_name);
-    if (!plug_name)                         /* regex match */
-        plug_name = xregex_match_sub_strdup(dev->xmatch,
-                                            e->cur->u.setplugstate.plug_mp);
+        plug_name = e->cur->u.setplugstate.plug_name;
+    if (!plug_name && (sub = xregex_match_sub(dev->xmatch,
+                                    e->cur->u.setplugstate.plug_mp, &len)))
+        plug_name = arena_memdup(act->arena, sub, len); /* regex match */
     if (!plug_name && (e->plugs && list_count(e->plugs) > 0)) {
         Plug *plug = list_peek(e->plugs);
         if (plug->name)
-            plug_name = xstrdup(plug->name);/* use action target */
+            plug_name = plug->name;         /* use action target */
     }
     /* if no plug name, do nothing */
 
     if (plug_name) {
-        char *str = xregex_match_sub_strdup(dev->xmatch,
-                                            e->cur->u.setplugstate.stat_mp);
+        char *str = NULL;
         Plug *plug = pluglist_find(dev->plugs, plug_name);
 
+        if ((sub = xregex_match_sub(dev->xmatch,
+                                    e->cur->u.setplugstate.stat_mp, &len)))
+            str = arena_memdup(act->arena, sub, len);
+
         if (str && plug && plug->node) {
             InterpState state = ST_UNKNOWN;
             ListIterator itr;
@@ -1103,17 +1584,15 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
             }
             list_iterator_destroy(itr);
 
-            if ((arg = arglist_find(act->arglist, plug->node))) {
+            if ((arg = arglist_find(act->arglist, plug->nodeid))) {
                 arg->state = state;
                 if (arg->val)
                     xfree(arg->val);
                 arg->val = xstrdup(str);
+                arglist_set_fresh(act->arglist, arg);
             }
         }
-        if (str)
-            xfree(str);
         /* if no match, do nothing */
-        xfree(plug_name);
     }
 
     return finished;
@@ -1128,13 +1607,9 @@ static bool _process_expect(Device *dev, Action *act, ExecCtx *e)
     xregex_match_recycle(dev->xmatch);
     if ((str = _getregex_buf(dev->from, e->cur->u.expect.exp, dev->xmatch))) {
         if (act->vpf_fun) {
-            char *matchstr = xregex_match_strdup(dev->xmatch);
-            char *memstr = dbg_memstr(matchstr, strlen(matchstr));
-
-            act->vpf_fun(act->client_id, "recv(%s): '%s'", dev->name, memstr);
+            char *memstr = _memstr(act, str, xregex_match_strlen(dev->xmatch));
 
-            xfree(memstr);
-            xfree(matchstr);
+            act->vpf_fun(act->cmd_id, "recv(%s): '%s'", dev->name, memstr);
         }
         xfree(str);
         finished = TRUE;
@@ -1142,24 +1617,6 @@ static bool _process_expect(Device *dev, Action *act, ExecCtx *e)
     return finished;
 }
 
-/*
- * Wrapped hostlist_ranged_string() with internal buffer allocation,
- * which caller must xfree().
- */
-#define CHUNKSIZE 80
-static char *_xhostlist_ranged_string(hostlist_t hl)
-{
-    int size = 0;
-    char *str = NULL;
-
-    do {
-        str = (size == 0) ? xmalloc(CHUNKSIZE) : xrealloc(str, size+CHUNKSIZE);
-        size += CHUNKSIZE;
-    } while (hostlist_ranged_string(hl, size, str) == -1);
-
-    return str;
-}
-
 static bool _process_send(Device *dev, Action *act, ExecCtx *e)
 {
     bool finished = FALSE;
@@ -1195,9 +1652,13 @@ static bool _process_send(Device *dev, Action *act, ExecCtx *e)
                 }
 
                 hostlist_sort(hl);
-                names = _xhostlist_ranged_string(hl);
-                str = hsprintf(e->cur->u.send.fmt, names);
-                xfree (names);
+                if (!(names = hostlist_ranged_string_malloc(hl))) {
+                    err(TRUE, "_process_send(%s): hostlist_ranged_string",
+                        dev->name);
+                    goto range_cleanup;
+                }
+                str = arena_sprintf(act->arena, e->cur->u.send.fmt, names);
+                free (names);
             range_cleanup:
                 if (itr)
                     list_iterator_destroy(itr);
@@ -1206,11 +1667,12 @@ static bool _process_send(Device *dev, Action *act, ExecCtx *e)
             }
             else {
                 Plug *plug = list_peek(e->plugs);
-                str = hsprintf(e->cur->u.send.fmt, (plug->name ? plug->name : "[unresolved]"));
+                str = arena_sprintf(act->arena, e->cur->u.send.fmt,
+                                    (plug->name ? plug->name : "[unresolved]"));
             }
         }
         else
-            str = hsprintf(e->cur->u.send.fmt, NULL);
+            str = arena_sprintf(act->arena, e->cur->u.send.fmt, NULL);
 
         if (str) {
             written = cbuf_write(dev->to, str, strlen(str), &dropped);
@@ -1221,20 +1683,16 @@ static bool _process_send(Device *dev, Action *act, ExecCtx *e)
             else if (dropped > 0)
                 err(FALSE, "_process_send(%s): buffer overrun, %d dropped",
                     dev->name, dropped);
-            else {
-                char *memstr = dbg_memstr(str, strlen(str));
+            else if (act->vpf_fun) {
+                char *memstr = _memstr(act, str, strlen(str));
 
-                if (act->vpf_fun)
-                    act->vpf_fun(act->client_id, "send(%s): '%s'",
-                                 dev->name, memstr);
-                xfree(memstr);
+                act->vpf_fun(act->cmd_id, "send(%s): '%s'",
+                             dev->name, memstr);
             }
             assert(written < 0 || (dropped == strlen(str) - written));
         }
 
         e->processing = TRUE;
-
-        xfree(str);
     }
 
     if (cbuf_is_empty(dev->to)) {           /* finished! */
@@ -1257,7 +1715,7 @@ static bool _process_delay(Device *dev, Action *act, ExecCtx *e,
     /* first time */
     if (!e->processing) {
         if (act->vpf_fun)
-            act->vpf_fun(act->client_id, "delay(%s): %ld.%-6.6ld", dev->name,
+            act->vpf_fun(act->cmd_id, "delay(%s): %ld.%-6.6ld", dev->name,
                     delay.tv_sec, delay.tv_usec);
         e->processing = TRUE;
         if (gettimeofday(&act->delay_start, NULL) < 0)
@@ -1292,20 +1750,58 @@ Device *dev_create(const char *name)
     timerclear(&dev->last_retry);
     timerclear(&dev->last_ping);
     timerclear(&dev->ping_period);
+    dev->ondemand = FALSE;
+    dev->logging_out = FALSE;
+    timerclear(&dev->idle_timeout);
+    timerclear(&dev->last_activity);
 
     dev->to = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
     dev->from = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
 
     for (i = 0; i < NUM_SCRIPTS; i++)
         dev->scripts[i] = NULL;
+    dev->scriptset = NULL;
 
     dev->plugs = NULL;
+    dev->stale_plugs = list_create((ListDelF) pluglist_destroy);
+    dev->targetted = FALSE;
+    dev->signature = NULL;
     dev->retry_count = 0;
     dev->stat_successful_connects = 0;
     dev->stat_successful_actions = 0;
     return dev;
 }
 
+ScriptSet *dev_scriptset_create(void)
+{
+    ScriptSet *ss = (ScriptSet *) xmalloc(sizeof(ScriptSet));
+    int i;
+
+    ss->refcount = 1;
+    for (i = 0; i < NUM_SCRIPTS; i++)
+        ss->scripts[i] = NULL;
+    return ss;
+}
+
+ScriptSet *dev_scriptset_link(ScriptSet *ss)
+{
+    ss->refcount++;
+    return ss;
+}
+
+void dev_scriptset_unlink(ScriptSet *ss)
+{
+    int i;
+
+    assert(ss->refcount > 0);
+    if (--ss->refcount > 0)
+        return;
+    for (i = 0; i < NUM_SCRIPTS; i++)
+        if (ss->scripts[i] != NULL)
+            list_destroy(ss->scripts[i]);
+    xfree(ss);
+}
+
 /* helper for dev_findbyname */
 static int _match_name(Device * dev, void *key)
 {
@@ -1317,6 +1813,22 @@ Device *dev_findbyname(char *name)
     return list_find_first(dev_devices, (ListFindF) _match_name, name);
 }
 
+/*
+ * Find the device, and the plug on it, that controls an (interned) node.
+ * Return NULL if the node is not attached to any device.
+ */
+Device *dev_findbynode(char *node, Plug **plugp)
+{
+    NodeRoute *r;
+
+    _index_nodes();
+    if (!(r = hash_find(dev_nodes, node)))
+        return NULL;
+    if (plugp)
+        *plugp = r->plug;
+    return r->dev;
+}
+
 void dev_destroy(Device * dev)
 {
     int i;
@@ -1327,18 +1839,28 @@ void dev_destroy(Device * dev)
     if (dev->connect_state == DEV_CONNECTED)
         dev->disconnect(dev);
 
+    list_destroy(dev->acts);
+    if (dev_cmds)
+        hash_for_each(dev_cmds, (hash_arg_f) _cmd_forget_device, dev);
+
     xfree(dev->name);
     xfree(dev->specname);
+    if (dev->signature)
+        xfree(dev->signature);
     if (dev->data) {
         assert(dev->destroy != NULL);
         dev->destroy(dev->data);
     }
-    list_destroy(dev->acts);
     if (dev->plugs)
         pluglist_destroy(dev->plugs);
-    for (i = 0; i < NUM_SCRIPTS; i++)
-        if (dev->scripts[i] != NULL)
-            list_destroy(dev->scripts[i]);
+    list_destroy(dev->stale_plugs);
+    if (dev->scriptset)
+        dev_scriptset_unlink(dev->scriptset);
+    else {
+        for (i = 0; i < NUM_SCRIPTS; i++)
+            if (dev->scripts[i] != NULL)
+                list_destroy(dev->scripts[i]);
+    }
 
     cbuf_destroy(dev->to);
     cbuf_destroy(dev->from);
@@ -1362,7 +1884,49 @@ static void _enqueue_ping(Device * dev, struct timeval *timeout)
 }
 
 /*
- * Called prior to the select loop to initiate connects to all devices.
+ * Helper for dev_post_poll().  An on demand device that has been idle
+ * for its idle timeout runs its logout script (if any), then disconnects.
+ * If actions were enqueued while logging out, reconnect instead.
+ * Otherwise update timeout so poll will unblock when the device goes idle.
+ * Return TRUE if the action queue needs processing again.
+ */
+static bool _check_idle(Device * dev, struct timeval *timeout)
+{
+    struct timeval timeleft;
+    Action *act;
+
+    if (!dev->ondemand || dev->connect_state != DEV_CONNECTED)
+        return FALSE;
+
+    act = list_peek(dev->acts);
+    if (dev->logging_out) {
+        if (act == NULL) {
+            dbg(DBG_DEVICE, "%s: disconnecting idle device", dev->name);
+            _disconnect(dev);
+        } else if (act->com != PM_LOG_OUT) {
+            dbg(DBG_DEVICE, "%s: reconnecting after idle logout", dev->name);
+            _reconnect(dev, timeout);
+            return TRUE;
+        }
+    } else if (act == NULL && dev->logged_in) {
+        if (_timeout(&dev->last_activity, &dev->idle_timeout, &timeleft)) {
+            if (dev->scripts[PM_LOG_OUT] != NULL) {
+                dbg(DBG_DEVICE, "%s: logging out idle device", dev->name);
+                _enqueue_actions(dev, PM_LOG_OUT, NULL, NULL, NULL, 0, NULL);
+                dev->logging_out = TRUE;
+                return TRUE;
+            }
+            dbg(DBG_DEVICE, "%s: disconnecting idle device", dev->name);
+            _disconnect(dev);
+        } else
+            _update_timeout(timeout, &timeleft);
+    }
+    return FALSE;
+}
+
+/*
+ * Called prior to the select loop to initiate connects to all devices
+ * (except on demand devices, which connect when actions are enqueued).
  */
 void dev_initial_connect(void)
 {
@@ -1372,7 +1936,8 @@ void dev_initial_connect(void)
     itr = list_iterator_create(dev_devices);
     while ((dev = list_next(itr))) {
         assert(dev->connect_state == DEV_NOT_CONNECTED);
-        _connect(dev);
+        if (!dev->ondemand)
+            _connect(dev);
     }
     list_iterator_destroy(itr);
 }
@@ -1527,15 +2092,21 @@ void dev_post_poll(xpollfd_t pfd, struct timeval *timeout)
         /* Either initiate reconnect or recalculate timeout (for backoff)
          * so poll will unblock then.  If successful, _reconnect()
          * will enqueue a login action which will need processing below.
+         * An on demand device with nothing to do is just disconnected.
          */
-        if (ioerr || dev->connect_state == DEV_NOT_CONNECTED)
-            _reconnect(dev, timeout); /* can update dev->connect_state */
+        if (ioerr || dev->connect_state == DEV_NOT_CONNECTED) {
+            if (dev->ondemand && list_is_empty(dev->acts)) {
+                if (dev->connect_state != DEV_NOT_CONNECTED)
+                    _disconnect(dev);
+            } else
+                _reconnect(dev, timeout); /* can update dev->connect_state */
+        }
 
         /* If we are periodically "pinging" this device, we may need to
          * enqueue a ping action, or update the timeout so poll will
          * unblock when it is time to enqueue one.
          */
-        if (dev->connect_state == DEV_CONNECTED)
+        if (dev->connect_state == DEV_CONNECTED && !dev->logging_out)
             _enqueue_ping(dev, timeout);
 
         /* If any actions are enqueued, process them.  This is state machine
@@ -1547,6 +2118,21 @@ void dev_post_poll(xpollfd_t pfd, struct timeval *timeout)
          * we have to time out the actions (e.g. tell the user).
          */
          _process_action(dev, timeout);
+
+        /* On demand devices log out and disconnect when idle.
+         */
+        if (_check_idle(dev, timeout))
+            _process_action(dev, timeout);
+
+        /* Plug maps replaced by a config reload can go once the actions
+         * that referenced them are gone.
+         */
+        if (list_is_empty(dev->acts) && !list_is_empty(dev->stale_plugs)) {
+            PlugList pl;
+
+            while ((pl = list_pop(dev->stale_plugs)))
+                pluglist_destroy(pl);
+        }
     }
     list_iterator_destroy(itr);
 }
@@ -4,6 +4,8 @@
 void dev_init(bool short_circuit_delay);
 void dev_fini(void);
 void dev_initial_connect(void);
+void dev_reload_begin(void);
+void dev_reload_end(void);
 
 void dev_pre_poll(xpollfd_t pfd);
 void dev_post_poll(xpollfd_t pfd, struct timeval *tv);
@@ -86,6 +86,15 @@ typedef struct {
 } Stmt;
 typedef List Script;
 
+/*
+ * Scripts are compiled once per specification and shared by reference
+ * among all devices of that type.
+ */
+typedef struct {
+    int refcount;
+    Script scripts[NUM_SCRIPTS]; /* array of scripts */
+} ScriptSet;
+
 /*
  * Device
  */
@@ -97,6 +106,7 @@ typedef struct _device {
     char *name;                 /* name of device */
 
     char *specname;             /* name of specification, e.g. "icebox3" */
+    char *signature;            /* spec and host summary (compared on reload) */
 
     ConnectState connect_state; /* is device connected/open? */
     bool logged_in;             /* TRUE if login script has run successfully */
@@ -113,7 +123,10 @@ typedef struct _device {
     cbuf_t from;                /* buffer <- device */
 
     PlugList plugs;             /* list of Plugs (node name <-> plug name) */
+    List stale_plugs;           /* PlugLists replaced by reload, still in use */
+    bool targetted;             /* scratch: device is involved in command */
     Script scripts[NUM_SCRIPTS]; /* array of scripts */
+    ScriptSet *scriptset;       /* shared owner of scripts (if any) */
 
     struct timeval last_retry;  /* time of last reconnect retry */
     int retry_count;            /* number of retries attempted */
@@ -121,6 +134,11 @@ typedef struct _device {
     struct timeval last_ping;   /* time of last ping (if any) */
     struct timeval ping_period; /* configurable ping period (0.0 = none) */
 
+    bool ondemand;              /* connect only when actions are enqueued */
+    bool logging_out;           /* idle logout is in progress */
+    struct timeval idle_timeout;/* disconnect after idle this long (ondemand) */
+    struct timeval last_activity; /* time of last login/client action */
+
     int stat_successful_connects;
     int stat_successful_actions;
                                 /* network (e.g. tcp/serial)-specific methods */
@@ -134,21 +152,41 @@ typedef struct _device {
 } Device;
 
 typedef enum { ACT_ESUCCESS, ACT_EEXPFAIL, ACT_EABORT, ACT_ECONNECTTIMEOUT,
-               ACT_ELOGINTIMEOUT } ActError;
-typedef void (*ActionCB) (int client_id, ActError acterr, const char *fmt, ...);
-typedef void (*VerbosePrintf) (int client_id, const char *fmt, ...);
+               ACT_ELOGINTIMEOUT, ACT_ERELOAD } ActError;
+typedef void (*ActionCB) (int cmd_id, ActError acterr, const char *fmt, ...);
+typedef void (*VerbosePrintf) (int cmd_id, const char *fmt, ...);
 
 #define MIN_DEV_BUF     1024
 #define MAX_DEV_BUF     1024*64
 
+/*
+ * One command of a batch passed to dev_enqueue_batch().  'count' is set
+ * to the number of actions enqueued for it.
+ */
+typedef struct {
+    int com;                    /* script index */
+    hostlist_t hl;              /* target nodes */
+    int cmd_id;                 /* passed to the callbacks */
+    ArgList arglist;            /* argument for query commands */
+    int count;                  /* actions enqueued (out) */
+} BatchPart;
+
 void dev_add(Device * dev);
 int dev_enqueue_actions(int com, hostlist_t hl, ActionCB complete_fun,
-        VerbosePrintf vpf_fun, int client_id, ArgList arglist);
+        VerbosePrintf vpf_fun, int cmd_id, ArgList arglist);
+int dev_enqueue_batch(BatchPart *parts, int nparts, ActionCB complete_fun,
+        VerbosePrintf vpf_fun);
 bool dev_check_actions(int com, hostlist_t hl);
+int dev_cancel_actions(int cmd_id);
+
+ScriptSet *dev_scriptset_create(void);
+ScriptSet *dev_scriptset_link(ScriptSet *ss);
+void dev_scriptset_unlink(ScriptSet *ss);
 
 Device *dev_create(const char *name);
 void dev_destroy(Device * dev);
 Device *dev_findbyname(char *name);
+Device *dev_findbynode(char *node, Plug **plugp);
 List dev_getdevices(void);
 
 #endif /* PM_DEVICE_PRIVATE_H */
@@ -48,6 +48,7 @@
 #include "xmalloc.h"
 #include "xpoll.h"
 #include "xregex.h"
+#include "hprintf.h"
 #include "pluglist.h"
 #include "arglist.h"
 #include "device_private.h"
@@ -81,8 +82,12 @@ typedef struct {
     char *name;                 /* specification name, e.g. "icebox" */
     struct timeval timeout;     /* timeout for this device */
     struct timeval ping_period; /* ping period for this device 0.0 = none */
+    bool ondemand;              /* connect on demand, disconnect when idle */
+    struct timeval idle_timeout; /* idle time before disconnect (ondemand) */
     List plugs;                 /* list of plug names (e.g. "1" thru "10") */
     PreScript prescripts[NUM_SCRIPTS];  /* array of PreScripts */
+    ScriptSet *scriptset;       /* compiled scripts (on first use) */
+    char *signature;            /* summary of spec contents (on first use) */
 } Spec;                                 /*   script may be NULL if undefined */
 
 /* powerman.conf */
@@ -106,6 +111,7 @@ static void makeScript(int com, List stmts);
 static void destroyInterp(Interp *i);
 static Interp *makeInterp(InterpState state, char *str);
 static List copyInterpList(List ilist);
+static char *_spec_signature(Spec *spec);
 
 /* utility functions */
 static void _errormsg(char *msg);
@@ -138,10 +144,11 @@ static Spec current_spec;             /* Holds a Spec as it is built */
 /* other device configuration stuff */
 %token TOK_OFF_STRING TOK_ON_STRING
 %token TOK_MAX_PLUG_COUNT TOK_TIMEOUT TOK_DEV_TIMEOUT TOK_PING_PERIOD
+%token TOK_IDLE_TIMEOUT
 %token TOK_PLUG_NAME TOK_SCRIPT 
 
 /* powerman.conf stuff */
-%token TOK_DEVICE TOK_NODE TOK_ALIAS TOK_TCP_WRAPPERS TOK_LISTEN
+%token TOK_DEVICE TOK_NODE TOK_ALIAS TOK_TCP_WRAPPERS TOK_LISTEN TOK_RETRY
 
 /* general */
 %token TOK_MATCHPOS TOK_STRING_VAL TOK_NUMERIC_VAL TOK_YES TOK_NO
@@ -162,6 +169,7 @@ config_list     : config_list config_item
 ;
 config_item     : listen
                 | TCP_wrappers 
+                | retry
                 | device
                 | node
                 | alias
@@ -176,6 +184,12 @@ TCP_wrappers    : TOK_TCP_WRAPPERS         {
     conf_set_use_tcp_wrappers(FALSE);
 }
 ;
+retry           : TOK_RETRY TOK_YES {
+    conf_set_retry(TRUE);
+}               | TOK_RETRY TOK_NO {
+    conf_set_retry(FALSE);
+}
+;
 listen          : TOK_LISTEN TOK_STRING_VAL { 
     conf_add_listen($2);
 }
@@ -211,6 +225,7 @@ spec_item_list  : spec_item_list spec_item
 ;
 spec_item       : spec_timeout
                 | spec_ping_period
+                | spec_idle_timeout
                 | spec_plug_list
                 | spec_script_list
 ;
@@ -222,6 +237,11 @@ spec_ping_period: TOK_PING_PERIOD TOK_NUMERIC_VAL {
     _doubletotv(&current_spec.ping_period, _strtodouble($2));
 }
 ;
+spec_idle_timeout: TOK_IDLE_TIMEOUT TOK_NUMERIC_VAL {
+    _doubletotv(&current_spec.idle_timeout, _strtodouble($2));
+    current_spec.ondemand = TRUE;
+}
+;
 string_list     : string_list TOK_STRING_VAL {
     list_append((List)$1, xstrdup($2)); 
     $$ = $1; 
@@ -370,7 +390,7 @@ int parse_config_file (char *filename)
 
     scanner_init(filename);
 
-    yyin = fopen(filename, "r");
+    yyin = conf_fopen(filename);
     if (!yyin)
         err_exit(TRUE, "%s", filename);
 
@@ -434,8 +454,12 @@ static void _clear_current_spec(void)
     current_spec.plugs = NULL;
     timerclear(&current_spec.timeout);
     timerclear(&current_spec.ping_period);
+    current_spec.ondemand = FALSE;
+    timerclear(&current_spec.idle_timeout);
     for (i = 0; i < NUM_SCRIPTS; i++)
         current_spec.prescripts[i] = NULL;
+    current_spec.scriptset = NULL;
+    current_spec.signature = NULL;
 }
 
 static Spec *_copy_current_spec(void)
@@ -476,6 +500,10 @@ static void destroySpec(Spec * spec)
     for (i = 0; i < NUM_SCRIPTS; i++)
         if (spec->prescripts[i])
             list_destroy(spec->prescripts[i]);
+    if (spec->scriptset)
+        dev_scriptset_unlink(spec->scriptset);
+    if (spec->signature)
+        xfree(spec->signature);
     xfree(spec);
 }
 
@@ -672,10 +700,106 @@ static void _parse_hoststr(Device *dev, char *hoststr, char *flagstr)
     }
 }
 
+/*
+ * Compile the spec's scripts.  This is done once per spec, and the result
+ * is shared by all devices that use it.
+ */
+static ScriptSet *makeScriptSet(Spec *spec)
+{
+    ListIterator itr;
+    ScriptSet *ss;
+    int i;
+
+    ss = dev_scriptset_create();
+    for (i = 0; i < NUM_SCRIPTS; i++) {
+        PreStmt *p;
+
+        if (spec->prescripts[i] == NULL)
+            continue; /* unimplemented script */
+
+        ss->scripts[i] = list_create((ListDelF) destroyStmt);
+
+        /* copy the list of statements in each script */
+        itr = list_iterator_create(spec->prescripts[i]);
+        while((p = list_next(itr))) {
+            list_append(ss->scripts[i], makeStmt(p));
+        }
+        list_iterator_destroy(itr);
+    }
+    return ss;
+}
+
+/* append str to sig, consuming both */
+static char *_sigcat(char *sig, char *str)
+{
+    char *new = hsprintf("%s%s", sig, str);
+
+    xfree(sig);
+    xfree(str);
+    return new;
+}
+
+static char *_prescript_signature(List prestmts)
+{
+    ListIterator itr, iitr;
+    char *sig = xstrdup("{");
+    PreStmt *p;
+    Interp *ip;
+
+    itr = list_iterator_create(prestmts);
+    while ((p = list_next(itr))) {
+        sig = _sigcat(sig, hsprintf("%d:%d'%s':%ld.%06ld:%d:%d",
+                      p->type, p->str ? (int)strlen(p->str) : -1,
+                      p->str ? p->str : "", (long)p->tv.tv_sec,
+                      (long)p->tv.tv_usec, p->mp1, p->mp2));
+        if (p->interps) {
+            iitr = list_iterator_create(p->interps);
+            while ((ip = list_next(iitr)))
+                sig = _sigcat(sig, hsprintf("[%d:%d'%s']", ip->state,
+                              (int)strlen(ip->str), ip->str));
+            list_iterator_destroy(iitr);
+        }
+        if (p->prestmts)
+            sig = _sigcat(sig, _prescript_signature(p->prestmts));
+        sig = _sigcat(sig, xstrdup(";"));
+    }
+    list_iterator_destroy(itr);
+    return _sigcat(sig, xstrdup("}"));
+}
+
+/*
+ * Summarize everything in the spec that affects its devices, so that
+ * changed devices can be detected on reload by comparing strings.
+ */
+static char *_spec_signature(Spec *spec)
+{
+    ListIterator itr;
+    char *sig, *s;
+    int i;
+
+    sig = hsprintf("%s:%ld.%06ld:%ld.%06ld:%d:%ld.%06ld:", spec->name,
+                   (long)spec->timeout.tv_sec, (long)spec->timeout.tv_usec,
+                   (long)spec->ping_period.tv_sec,
+                   (long)spec->ping_period.tv_usec, spec->ondemand,
+                   (long)spec->idle_timeout.tv_sec,
+                   (long)spec->idle_timeout.tv_usec);
+    if (spec->plugs) {
+        itr = list_iterator_create(spec->plugs);
+        while ((s = list_next(itr)))
+            sig = _sigcat(sig, hsprintf("%d'%s'", (int)strlen(s), s));
+        list_iterator_destroy(itr);
+    }
+    for (i = 0; i < NUM_SCRIPTS; i++) {
+        sig = _sigcat(sig, hsprintf("%d", i));
+        if (spec->prescripts[i])
+            sig = _sigcat(sig, _prescript_signature(spec->prescripts[i]));
+    }
+    return sig;
+}
+
 static void makeDevice(char *devstr, char *specstr, char *hoststr, 
                         char *flagstr)
 {
-    ListIterator itr;
     Device *dev;
     Spec *spec;
     int i;
@@ -690,30 +814,26 @@ static void makeDevice(char *devstr, char *specstr, char *hoststr,
     dev->specname = xstrdup(specstr);
     dev->timeout = spec->timeout;
     dev->ping_period = spec->ping_period;
+    dev->ondemand = spec->ondemand;
+    dev->idle_timeout = spec->idle_timeout;
 
     _parse_hoststr(dev, hoststr, flagstr);
 
     /* create plugs (spec->plugs may be NULL) */
     dev->plugs = pluglist_create(spec->plugs);
 
-    /* transfer remaining info from the spec to the device */
-    for (i = 0; i < NUM_SCRIPTS; i++) {
-        PreStmt *p;
-
-        if (spec->prescripts[i] == NULL) {
-            dev->scripts[i] = NULL;
-            continue; /* unimplemented script */
-        }
-
-        dev->scripts[i] = list_create((ListDelF) destroyStmt);
+    /* share compiled scripts with other devices of this spec */
+    if (spec->scriptset == NULL)
+        spec->scriptset = makeScriptSet(spec);
+    dev->scriptset = dev_scriptset_link(spec->scriptset);
+    for (i = 0; i < NUM_SCRIPTS; i++)
+        dev->scripts[i] = dev->scriptset->scripts[i];
 
-        /* copy the list of statements in each script */
-        itr = list_iterator_create(spec->prescripts[i]);
-        while((p = list_next(itr))) {
-            list_append(dev->scripts[i], makeStmt(p));
-        }
-        list_iterator_destroy(itr);
-    }
+    /* on reload, devices with unchanged signature are kept running */
+    if (spec->signature == NULL)
+        spec->signature = _spec_signature(spec);
+    dev->signature = hsprintf("%s|%s|%s", spec->signature, hoststr,
+                              flagstr ? flagstr : "");
 
     dev_add(dev);
 }
@@ -29,14 +29,18 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 
 #include "list.h"
+#include "hash.h"
 #include "hostlist.h"
 #include "xtypes.h"
 #include "error.h"
@@ -44,20 +48,51 @@
 #include "xmalloc.h"
 #include "xpoll.h"
 #include "pluglist.h"
+#include "intern.h"
 #include "client.h"
+#include "device.h"
 #include "powerman.h"
+#include "hprintf.h"
+#include "xread.h"
+
+#define NODEIDS_HASH_SIZE   256     /* initial size, doubled as needed */
 
 typedef struct {
     char *name;
     hostlist_t hl;
 } alias_t;
 
+typedef struct {
+    char *name;
+    int id;
+} nodename_t;
+
+typedef struct {
+    char *path;
+    char *data;
+    int len;
+} conffile_t;
+
 static bool         conf_use_tcp_wrap = FALSE;
+static bool         conf_retry = FALSE;     /* retry once after timeout */
 static List         conf_listen = NULL;     /* list of host:port strings */
-static hostlist_t   conf_nodes = NULL;
-static List         conf_aliases = NULL;    /* list of alias_t's */
+static hostlist_t   conf_nodes = NULL;     /* for "nodes" query */
+static hash_t       conf_nodeids = NULL;   /* name -> nodename_t */
+static int          conf_nodeids_size = 0;
+static nodename_t **conf_nodenames = NULL; /* id -> nodename_t */
+static int          conf_nodenames_len = 0;
+static int          conf_nodenames_size = 0;
+static hostbits_t   conf_nodebits = NULL;  /* for lookups, validating targets */
+static hash_t       conf_aliases = NULL;    /* name -> alias_t */
+static char        *conf_filename = NULL;   /* for reload */
+static List         conf_snapshot = NULL;   /* files read by reload check */
+static bool         conf_recording = FALSE; /* add files to conf_snapshot */
 
 static bool _validate_config(void);
+static void _nodename_destroy(nodename_t *n);
+static void _nodeids_resize(int size);
+static hostbits_t _nodebits_create(void);
+static hash_t _aliases_create(void);
 static void _alias_destroy(alias_t *a);
 
 extern int parse_config_file(char *filename); /* yacc/lex parser */
@@ -69,13 +104,16 @@ extern int parse_config_file(char *filename); /* yacc/lex parser */
 void conf_init(char *filename)
 {
     struct stat stbuf;
+    char path[PATH_MAX];
     bool valid;
 
     conf_listen = list_create((ListDelF) xfree);
 
     conf_nodes = hostlist_create(NULL);
+    conf_nodebits = _nodebits_create();
+    _nodeids_resize(NODEIDS_HASH_SIZE);
 
-    conf_aliases = list_create((ListDelF) _alias_destroy);
+    conf_aliases = _aliases_create();
 
     /* validate config file */
     if (stat(filename, &stbuf) < 0)
@@ -83,6 +121,9 @@ void conf_init(char *filename)
     if ((stbuf.st_mode & S_IFMT) != S_IFREG)
         err_exit(FALSE, "%s is not a regular file\n", filename);
 
+    /* remember absolute path for reload (daemon changes directory) */
+    conf_filename = xstrdup(realpath(filename, path) ? path : filename);
+
     /*
      * Call yacc parser against config file.  The parser calls support
      * functions below and builds 'dev_devices' (devices.c),
@@ -102,38 +143,275 @@ void conf_fini(void)
 {
     if (conf_nodes != NULL)
         hostlist_destroy(conf_nodes);
+    if (conf_nodebits != NULL)
+        hostbits_destroy(conf_nodebits);
+    if (conf_nodeids != NULL)
+        hash_destroy(conf_nodeids);
+    if (conf_nodenames != NULL) {
+        int i;
+
+        for (i = 0; i < conf_nodenames_len; i++)
+            _nodename_destroy(conf_nodenames[i]);
+        xfree(conf_nodenames);
+    }
+    if (conf_filename != NULL)
+        xfree(conf_filename);
+}
+
+/* helpers for conf_fopen */
+static void _conffile_destroy(conffile_t *f)
+{
+    xfree(f->path);
+    xfree(f->data);
+    xfree(f);
+}
+
+static int _match_conffile(conffile_t *f, char *path)
+{
+    return (strcmp(f->path, path) == 0);
+}
+
+static conffile_t *_conffile_add(char *path, char *data, int len)
+{
+    conffile_t *f = (conffile_t *)xmalloc(sizeof(conffile_t));
+
+    f->path = xstrdup(path);
+    f->data = xmalloc(len + 1);
+    memcpy(f->data, data, len);
+    f->len = len;
+    list_append(conf_snapshot, f);
+    return f;
 }
 
 /*
- * Check the config file and exit with error if any problems are found.
+ * Open a config file for the parser.  During a reload the config is
+ * parsed twice, first in a child process that may exit on error, then
+ * in the daemon.  The child records the contents of each file it reads
+ * in conf_snapshot and passes them back, and the daemon parses those,
+ * so a file that changes in between cannot make the second parse fail.
  */
-static bool _validate_config(void)
+FILE *conf_fopen(char *path)
+{
+    conffile_t *f = NULL;
+    char *data;
+    int size = BUFSIZ, len = 0, n;
+    FILE *fp;
+
+    if (conf_snapshot)
+        f = list_find_first(conf_snapshot, (ListFindF)_match_conffile, path);
+    if (f == NULL) {
+        if ((fp = fopen(path, "r")) == NULL || !conf_recording)
+            return fp;
+        data = xmalloc(size);
+        while ((n = fread(data + len, 1, size - len, fp)) > 0) {
+            if ((len += n) == size)
+                data = xrealloc(data, (size *= 2));
+        }
+        if (ferror(fp)) {
+            fclose(fp);
+            xfree(data);
+            return NULL;
+        }
+        fclose(fp);
+        f = _conffile_add(path, data, len);
+        xfree(data);
+    }
+
+    /* parse the recorded copy, not the file */
+    if ((fp = tmpfile()) == NULL)
+        return NULL;
+    if (fwrite(f->data, 1, f->len, fp) != f->len) {
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    return fp;
+}
+
+/* helper for conf_reload - send conf_snapshot to the daemon (in child) */
+static void _snapshot_write(int fd)
 {
     ListIterator itr;
+    conffile_t *f;
+    char *hdr;
+
+    itr = list_iterator_create(conf_snapshot);
+    while ((f = list_next(itr))) {
+        hdr = hsprintf("%s\n%d\n", f->path, f->len);
+        xwrite_all(fd, hdr, strlen(hdr));
+        xwrite_all(fd, f->data, f->len);
+        xfree(hdr);
+    }
+    list_iterator_destroy(itr);
+}
+
+/* helper for conf_reload - read conf_snapshot from the child.
+ * Return FALSE if it is incomplete.
+ */
+static bool _snapshot_read(int fd)
+{
+    char *buf, *path, *p, *end, *nl;
+    int size = BUFSIZ, len = 0, n;
     bool valid = TRUE;
-    alias_t *a;
+    long flen;
+
+    buf = xmalloc(size);
+    do {
+        if (len + 1 >= size)        /* leave room for a terminating nul */
+            buf = xrealloc(buf, (size *= 2));
+        n = read(fd, buf + len, size - len - 1);
+        if (n < 0 && errno != EINTR) {
+            err(TRUE, "%s: reading reload check", conf_filename);
+            xfree(buf);
+            return FALSE;
+        }
+        if (n > 0)
+            len += n;
+    } while (n != 0);
+    buf[len] = '\0';
+
+    for (p = buf, end = buf + len; p < end; p += flen) {
+        path = p;
+        if ((nl = memchr(p, '\n', end - p)) == NULL) {
+            valid = FALSE;
+            break;
+        }
+        *nl = '\0';
+        flen = strtol(nl + 1, &p, 10);
+        if (*p++ != '\n' || flen < 0 || flen > end - p) {
+            valid = FALSE;
+            break;
+        }
+        _conffile_add(path, p, flen);
+    }
+    xfree(buf);
+    return valid;
+}
 
-    /* make sure aliases do not point to bogus node names */
-    itr = list_iterator_create(conf_aliases);
-    while ((a = list_next(itr)) != NULL) {
-        hostlist_iterator_t hitr = hostlist_iterator_create(a->hl);
-        char *host;
-
-        if (hitr == NULL)
-            err_exit(FALSE, "hostlist_iterator_create failed");
-        while ((host = hostlist_next(hitr)) != NULL) {
-            if (!conf_node_exists(host)) {
-                err(FALSE, "alias '%s' references nonexistant node '%s'",
-                        a->name, host);
+/* helper for conf_reload - parse into fresh config state */
+static bool _reload_parse(void)
+{
+    conf_use_tcp_wrap = FALSE;
+    conf_retry = FALSE;
+    conf_listen = list_create((ListDelF) xfree);
+    conf_nodes = hostlist_create(NULL);
+    conf_nodebits = _nodebits_create();
+    conf_aliases = _aliases_create();
+    dev_reload_begin();
+
+    parse_config_file(conf_filename);
+
+    return _validate_config();
+}
+
+/*
+ * Re-read the config file, e.g. on SIGHUP.  Since the parser exits on
+ * error, the file is first checked in a child process, and if that fails
+ * the current configuration stays in effect.  Otherwise the daemon parses
+ * the same contents the child read (see conf_fopen()), devices that are
+ * unchanged keep running (see dev_reload_end()), and node names and aliases
+ * are replaced.  Listen addresses cannot be changed without a restart.
+ * Return TRUE on success.
+ */
+bool conf_reload(void)
+{
+    List old_listen = conf_listen;
+    hostlist_t old_nodes = conf_nodes;
+    hostbits_t old_nodebits = conf_nodebits;
+    hash_t old_aliases = conf_aliases;
+    bool valid = FALSE;
+    int status;
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        err(TRUE, "pipe");
+        return FALSE;
+    }
+    conf_snapshot = list_create((ListDelF) _conffile_destroy);
+    fflush(NULL);
+    switch ((pid = fork())) {
+        case -1:
+            err(TRUE, "fork");
+            close(fds[0]);
+            close(fds[1]);
+            break;
+        case 0:
+            close(fds[0]);
+            conf_recording = TRUE;
+            if (!_reload_parse())
+                exit(1);
+            _snapshot_write(fds[1]);
+            exit(0);
+            /*NOTREACHED*/
+        default:
+            close(fds[1]);
+            valid = _snapshot_read(fds[0]);
+            close(fds[0]);
+            if (waitpid(pid, &status, 0) < 0) {
+                err(TRUE, "waitpid");
                 valid = FALSE;
-                free(host);
-                break;
-            } else
-                free(host);
-        }
-        hostlist_iterator_destroy(hitr);
+            } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                valid = FALSE;
+            if (!valid)
+                err(FALSE, "%s: reload failed, keeping current configuration",
+                    conf_filename);
+            break;
     }
-    list_iterator_destroy(itr);
+    if (!valid) {
+        list_destroy(conf_snapshot);
+        conf_snapshot = NULL;
+        return FALSE;
+    }
+
+    if (!_reload_parse())           /* should not happen */
+        err_exit(FALSE, "%s: reload failed", conf_filename);
+    list_destroy(conf_snapshot);
+    conf_snapshot = NULL;
+    dev_reload_end();
+
+    list_destroy(conf_listen);
+    conf_listen = old_listen;
+    hostlist_destroy(old_nodes);
+    hostbits_destroy(old_nodebits);
+    hash_destroy(old_aliases);
+
+    return TRUE;
+}
+
+/*
+ * Check the config file and exit with error if any problems are found.
+ */
+/* helper for _validate_config - return 1 if alias is bad */
+static int _alias_validate(alias_t *a, void *arg)
+{
+    hostlist_iterator_t hitr = hostlist_iterator_create(a->hl);
+    char *host;
+    int bad = 0;
+
+    if (hitr == NULL)
+        err_exit(FALSE, "hostlist_iterator_create failed");
+    while ((host = hostlist_next(hitr)) != NULL) {
+        if (!conf_node_exists(host)) {
+            err(FALSE, "alias '%s' references nonexistant node '%s'",
+                    a->name, host);
+            bad = 1;
+            free(host);
+            break;
+        } else
+            free(host);
+    }
+    hostlist_iterator_destroy(hitr);
+    return bad;
+}
+
+static bool _validate_config(void)
+{
+    bool valid = TRUE;
+
+    /* make sure aliases do not point to bogus node names */
+    if (hash_for_each(conf_aliases, (hash_arg_f) _alias_validate, NULL) > 0)
+        valid = FALSE;
 
     /* make sure there is at least one node defined */
     if (hostlist_is_empty(conf_nodes)) {
@@ -155,12 +433,90 @@ static bool _validate_config(void)
  * Node conf_nodes list.
  */
 
-bool conf_node_exists(char *node)
+/* Node names are kept in a hostlist (compact, for listing them) and a
+ * hostbits (for lookups and for checking whole target lists).
+ */
+
+/* Every node name ever configured gets a small integer id, so per-node
+ * state can be kept in arrays (see arglist.c).  Entries are never removed,
+ * so ids and (interned) name pointers stay valid across a reload.
+ * The conf_nodenames array owns the entries; conf_nodeids only indexes
+ * them, and is rebuilt at twice the size whenever it holds more entries
+ * than buckets, since hash tables do not grow by themselves.
+ */
+static void _nodename_destroy(nodename_t *n)
+{
+    xfree(n);
+}
+
+static void _nodeids_resize(int size)
+{
+    int i;
+
+    if (conf_nodeids != NULL)
+        hash_destroy(conf_nodeids);
+    conf_nodeids = hash_create(size, (hash_key_f)hash_key_string,
+                               (hash_cmp_f)strcmp, NULL);
+    if (conf_nodeids == NULL)
+        err_exit(TRUE, "hash_create");
+    conf_nodeids_size = size;
+    for (i = 0; i < conf_nodenames_len; i++)
+        hash_insert(conf_nodeids, conf_nodenames[i]->name, conf_nodenames[i]);
+}
+
+static nodename_t *_nodename_register(char *node)
+{
+    nodename_t *n;
+
+    if ((n = hash_find(conf_nodeids, node)))
+        return n;
+    if (conf_nodenames_len == conf_nodenames_size) {
+        int size = (conf_nodenames_size + 256) * sizeof(nodename_t *);
+
+        conf_nodenames = (nodename_t **)(conf_nodenames_size == 0
+                                ? xmalloc(size)
+                                : xrealloc((char *)conf_nodenames, size));
+        conf_nodenames_size += 256;
+    }
+    n = (nodename_t *)xmalloc(sizeof(nodename_t));
+    n->name = intern(node);
+    n->id = conf_nodenames_len;
+    conf_nodenames[conf_nodenames_len++] = n;
+    if (conf_nodenames_len > conf_nodeids_size)
+        _nodeids_resize(conf_nodeids_size * 2);
+    else
+        hash_insert(conf_nodeids, n->name, n);
+
+    return n;
+}
+
+/* Return id of node, or -1 if it has never been configured. */
+int conf_node_id(char *node)
+{
+    nodename_t *n = hash_find(conf_nodeids, node);
+
+    return n ? n->id : -1;
+}
+
+/* Return the (shared, read-only) name of node id. */
+char *conf_node_name(int id)
+{
+    assert(id >= 0 && id < conf_nodenames_len);
+    return conf_nodenames[id]->name;
+}
+
+static hostbits_t _nodebits_create(void)
 {
-    int res;
+    hostbits_t hb = hostbits_create(NULL);
 
-    res = hostlist_find(conf_nodes, node);
-    return (res == -1 ? FALSE : TRUE);
+    if (hb == NULL)
+        err_exit(FALSE, "hostbits_create failed");
+    return hb;
+}
+
+bool conf_node_exists(char *node)
+{
+    return (hostbits_find(conf_nodebits, node) == 1);
 }
 
 bool conf_addnodes(char *nodelist)
@@ -170,14 +526,14 @@ bool conf_addnodes(char *nodelist)
     char *node;
     int res = TRUE;
 
-    while ((node = hostlist_next(itr))) {
+    while ((node = intern_hostlist_next(itr))) {
         if (conf_node_exists(node)) {
-            free(node);
             res = FALSE;
             break;
         } else {
-            hostlist_push(conf_nodes, node);
-            free(node);
+            _nodename_register(node);
+            hostbits_insert_host(conf_nodebits, node);
+            hostlist_push_host(conf_nodes, node);
         }
     }
     hostlist_iterator_destroy(itr);
@@ -191,6 +547,12 @@ hostlist_t conf_getnodes(void)
     return conf_nodes;
 }
 
+/* Caller must not modify or free the result. */
+hostbits_t conf_getnodebits(void)
+{
+    return conf_nodebits;
+}
+
 /*
  * Accessor functions for misc. configurable values.
  */
@@ -209,6 +571,16 @@ void conf_set_use_tcp_wrappers(bool val)
     conf_use_tcp_wrap = val;
 }
 
+bool conf_get_retry(void)
+{
+    return conf_retry;
+}
+
+void conf_set_retry(bool val)
+{
+    conf_retry = val;
+}
+
 List conf_get_listen(void)
 {
     return conf_listen;
@@ -223,44 +595,55 @@ void conf_add_listen(char *hostport)
  * Manage a list of nodename aliases.
  */
 
-static int _alias_match(alias_t *a, char *name)
+static hash_t _aliases_create(void)
 {
-    return (strcmp(a->name, name) == 0);
+    return hash_create(0, (hash_key_f)hash_key_string, (hash_cmp_f)strcmp,
+                       (hash_del_f)_alias_destroy);
 }
 
-/* Expand any aliases present in hostlist.
+/* Expand any aliases present in hostlist in one pass.  Hosts that are not
+ * aliases keep their order and alias expansions follow them.  If anything
+ * was expanded, hl is destroyed and a new hostlist is returned, else hl
+ * is returned unchanged.
  * N.B. Aliases cannot contain other aliases.
  */
-void conf_exp_aliases(hostlist_t hl)
+hostlist_t conf_exp_aliases(hostlist_t hl)
 {
     hostlist_iterator_t itr = NULL;
-    hostlist_t newhosts = hostlist_create(NULL);
+    hostlist_t hosts, newhosts;
+    bool expanded = FALSE;
     char *host;
 
-    /* Put the expansion of any aliases in the hostlist into 'newhosts',
-     * deleting the original reference from the hostlist.
-     */
-    if (newhosts == NULL)
+    if (hash_is_empty(conf_aliases))
+        return hl;
+
+    if ((hosts = hostlist_create(NULL)) == NULL)
+        err_exit(FALSE, "hostlist_create failed");
+    if ((newhosts = hostlist_create(NULL)) == NULL)
         err_exit(FALSE, "hostlist_create failed");
     if ((itr = hostlist_iterator_create(hl)) == NULL)
         err_exit(FALSE, "hostlist_iterator_create failed");
     while ((host = hostlist_next(itr)) != NULL) {
-        alias_t *a;
+        alias_t *a = hash_find(conf_aliases, host);
 
-        a = list_find_first(conf_aliases, (ListFindF) _alias_match, host);
         if (a) {
-            hostlist_delete_host(hl, host);
             hostlist_push_list(newhosts, a->hl);
-            hostlist_iterator_reset(itr); /* not sure of itr position after
-                                             insertion/deletion so reset */
-        }
+            expanded = TRUE;
+        } else
+            hostlist_push_host(hosts, host);
         free(host);
     }
     hostlist_iterator_destroy(itr);
 
-    /* dump the contents of 'newhosts' into the hostlist */
-    hostlist_push_list(hl, newhosts);
+    if (!expanded) {
+        hostlist_destroy(hosts);
+        hostlist_destroy(newhosts);
+        return hl;
+    }
+    hostlist_destroy(hl);
+    hostlist_push_list(hosts, newhosts);
     hostlist_destroy(newhosts);
+    return hosts;
 }
 
 static void _alias_destroy(alias_t *a)
@@ -276,7 +659,7 @@ static alias_t *_alias_create(char *name, char *hosts)
 {
     alias_t *a = NULL;
 
-    if (!list_find_first(conf_aliases, (ListFindF) _alias_match, name)) {
+    if (!hash_find(conf_aliases, name)) {
         a = (alias_t *)xmalloc(sizeof(alias_t));
         a->name= xstrdup(name);
         a->hl = hostlist_create(hosts);
@@ -296,7 +679,7 @@ bool conf_add_alias(char *name, char *hosts)
     alias_t *a;
 
     if ((a = _alias_create(name, hosts))) {
-        list_push(conf_aliases, a);
+        hash_insert(conf_aliases, a->name, a);
         return TRUE;
     }
     return FALSE;
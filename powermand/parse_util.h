@@ -1,20 +1,30 @@
 #ifndef PM_PARSE_UTIL_H
 #define PM_PARSE_UTIL_H
 
+#include <stdio.h>
+
 void conf_init(char *filename);
 void conf_fini(void);
+bool conf_reload(void);
+FILE *conf_fopen(char *path);
 
 bool conf_addnodes(char *nodelist);
 bool conf_node_exists(char *node);
+int conf_node_id(char *node);
+char *conf_node_name(int id);
 hostlist_t conf_getnodes(void);
+hostbits_t conf_getnodebits(void);
 
 bool conf_get_use_tcp_wrappers(void);
 void conf_set_use_tcp_wrappers(bool val);
 
+bool conf_get_retry(void);
+void conf_set_retry(bool val);
+
 List conf_get_listen(void);
 void conf_add_listen(char *hostport);
 
-void conf_exp_aliases(hostlist_t hl);
+hostlist_t conf_exp_aliases(hostlist_t hl);
 bool conf_add_alias(char *name, char *hosts);
 
 #endif  /* PM_PARSE_UTIL_H */
@@ -48,7 +48,9 @@
 #include "xmalloc.h"
 #include "xpoll.h"
 #include "xsignal.h"
+#include "xpty.h"
 #include "pluglist.h"
+#include "intern.h"
 #include "device.h"
 #include "daemon.h"
 #include "client.h"
@@ -61,9 +63,12 @@
 static void _usage(char *prog);
 static void _version(void);
 static void _noop_handler(int signum);
+static void _reload_handler(int signum);
 static void _exit_handler(int signum);
 static void _select_loop(void);
 
+static int reload_pipe[2] = { -1, -1 }; /* SIGHUP handler -> select loop */
+
 #define OPTIONS "c:fhd:VsY1"
 #if HAVE_GETOPT_LONG
 #define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
@@ -167,6 +172,15 @@ int main(int argc, char **argv)
         dbg_notty();
     }
 
+    /* SIGHUP triggers a config reload from the select loop (set up after
+     * daemon_init(), which closes fd's and ignores SIGHUP).
+     */
+    if (pipe(reload_pipe) < 0)
+        err_exit(TRUE, "pipe");
+    nonblock_set(reload_pipe[0]);
+    nonblock_set(reload_pipe[1]);
+    xsignal(SIGHUP, _reload_handler);
+
     /* We now have a socket at listener fd running in listen mode */
     /* and a file descriptor for communicating with each device */
     _select_loop();
@@ -210,6 +224,7 @@ static void _select_loop(void)
 
         cli_pre_poll(pfd);
         dev_pre_poll(pfd);
+        xpollfd_set(pfd, reload_pipe[0], XPOLLIN);
 
         n = xpoll(pfd, timerisset(&tmout) ? &tmout : NULL);
         timerclear(&tmout);
@@ -222,6 +237,14 @@ static void _select_loop(void)
         cli_post_poll(pfd);
         dev_post_poll(pfd, &tmout);
 
+        if (xpollfd_revents(pfd, reload_pipe[0]) & XPOLLIN) {
+            char buf[64];
+
+            while (read(reload_pipe[0], buf, sizeof(buf)) > 0)
+                ;
+            conf_reload();
+        }
+
         if (cli_server_done())
             break;
     }
@@ -233,11 +256,22 @@ static void _noop_handler(int signum)
     /* do nothing */
 }
 
+static void _reload_handler(int signum)
+{
+    int saved_errno = errno;
+
+    if (write(reload_pipe[1], "", 1) < 0) {
+        /* pipe full - a reload is already pending */
+    }
+    errno = saved_errno;
+}
+
 static void _exit_handler(int signum)
 {
     cli_fini();
     dev_fini();
     conf_fini();
+    intern_fini();
     err_exit(FALSE, "exiting on signal %d", signum);
 }
 
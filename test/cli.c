@@ -26,10 +26,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "libpowerman.h"
 
 static pm_err_t list_nodes(pm_handle_t pm);
+static pm_err_t hosts_status(pm_handle_t pm, char *hosts);
+static pm_err_t hosts_async(pm_handle_t pm, char *hosts);
+static pm_err_t hosts_persist(pm_handle_t pm, char *hosts);
+static pm_err_t hosts_threads(pm_handle_t pm, char *hosts);
 static void usage(void);
 
 #define statstr(s) ((s) == PM_ON ? "on" : (s) == PM_OFF ? "off" : "unknown")
@@ -42,6 +48,7 @@ main(int argc, char *argv[])
     pm_handle_t pm;
     char ebuf[64];
     char *server, *node = NULL;
+    int flags = 0;
     char cmd;
 
     if (argc < 3 || argc > 4)
@@ -50,12 +57,15 @@ main(int argc, char *argv[])
     cmd = argv[2][0];
     if (argc == 3 && cmd != 'l')
         usage();
-    if (argc == 4 && cmd != '1' && cmd != '0' && cmd != 'c' && cmd != 'q')
+    if (argc == 4 && cmd != '1' && cmd != '0' && cmd != 'c' && cmd != 'q'
+                  && cmd != 'Q' && cmd != 'a' && cmd != 'p' && cmd != 't')
         usage();
     if (argc == 4)
         node = argv[3];
+    if (cmd == 'p')
+        flags |= PM_CONN_PERSIST;
 
-    if ((err = pm_connect(server, NULL, &pm, 0)) != PM_ESUCCESS) {
+    if ((err = pm_connect(server, NULL, &pm, flags)) != PM_ESUCCESS) {
         fprintf(stderr, "%s: %s\n", server,
                 pm_strerror(err, ebuf, sizeof(ebuf)));
         exit(1);
@@ -79,6 +89,18 @@ main(int argc, char *argv[])
             if ((err = pm_node_status(pm, node, &ns)) == PM_ESUCCESS)
                 printf("%s: %s\n", node, statstr(ns));
             break;
+        case 'Q':
+            err = hosts_status(pm, node);
+            break;
+        case 'a':
+            err = hosts_async(pm, node);
+            break;
+        case 'p':
+            err = hosts_persist(pm, node);
+            break;
+        case 't':
+            err = hosts_threads(pm, node);
+            break;
     }
 
     if (err != PM_ESUCCESS) {
@@ -107,10 +129,148 @@ list_nodes(pm_handle_t pm)
     return err;
 }
 
+static void
+print_result(pm_result_t pmr, int query)
+{
+    char ebuf[64];
+    int i;
+
+    for (i = 0; i < pm_result_count(pmr); i++) {
+        if (pm_result_err(pmr, i) != PM_ESUCCESS && pm_result_errstr(pmr, i))
+            printf("%s: %s (%s)\n", pm_result_node(pmr, i),
+                   pm_strerror(pm_result_err(pmr, i), ebuf, sizeof(ebuf)),
+                   pm_result_errstr(pmr, i));
+        else if (pm_result_err(pmr, i) != PM_ESUCCESS)
+            printf("%s: %s\n", pm_result_node(pmr, i),
+                   pm_strerror(pm_result_err(pmr, i), ebuf, sizeof(ebuf)));
+        else
+            printf("%s: %s\n", pm_result_node(pmr, i),
+                   query ? statstr(pm_result_state(pmr, i)) : "success");
+    }
+}
+
+/* Query the status of all [hosts] in one call.
+ */
+static pm_err_t
+hosts_status(pm_handle_t pm, char *hosts)
+{
+    pm_result_t pmr;
+    pm_err_t err;
+
+    err = pm_hosts_status(pm, hosts, &pmr);
+    if (pmr) {
+        print_result(pmr, 1);
+        pm_result_destroy(pmr);
+    }
+    return err;
+}
+
+/* Turn [hosts] on and query their status before and after, with all
+ * three requests in flight at once, and print the results in order.
+ */
+static pm_err_t
+hosts_async(pm_handle_t pm, char *hosts)
+{
+    pm_op_t ops[] = { PM_OP_STATUS, PM_OP_ON, PM_OP_STATUS };
+    pm_request_t req[3];
+    pm_result_t pmr;
+    pm_err_t err;
+    struct pollfd pfd;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if ((err = pm_submit(pm, ops[i], hosts, &req[i])) != PM_ESUCCESS)
+            return err;
+    }
+    pfd.fd = pm_fd(pm);
+    pfd.events = POLLIN;
+    for (i = 0; i < 3; i++) {
+        while ((err = pm_complete(pm, req[i], &pmr)) == PM_EAGAIN) {
+            if (poll(&pfd, 1, -1) < 0)
+                return PM_ERRNOVALID;
+            if ((err = pm_poll(pm)) != PM_ESUCCESS)
+                return err;
+        }
+        printf("request %d: %s\n", i, err == PM_ESUCCESS ? "success"
+                                                         : "failure");
+        if (pmr) {
+            print_result(pmr, ops[i] == PM_OP_STATUS);
+            pm_result_destroy(pmr);
+        }
+    }
+    return PM_ESUCCESS;
+}
+
+/* Query the status of [hosts] on a persistent handle, wait for a line
+ * on stdin (the server may be restarted meanwhile), and query again.
+ */
+static pm_err_t
+hosts_persist(pm_handle_t pm, char *hosts)
+{
+    char buf[64];
+    pm_err_t err;
+
+    if ((err = hosts_status(pm, hosts)) != PM_ESUCCESS)
+        return err;
+    if (!fgets(buf, sizeof(buf), stdin))
+        return PM_EBADARG;
+    return hosts_status(pm, hosts);
+}
+
+#define NTHREADS    4
+#define NQUERIES    8
+
+struct query_thread {
+    pthread_t t;
+    pm_handle_t pm;
+    char *hosts;
+    int ok;
+};
+
+static void *
+query_thread(void *arg)
+{
+    struct query_thread *q = arg;
+    pm_result_t pmr;
+    int i;
+
+    for (i = 0; i < NQUERIES; i++) {
+        if (pm_hosts_status(q->pm, q->hosts, &pmr) == PM_ESUCCESS
+                        && pm_result_count(pmr) > 0)
+            q->ok++;
+        pm_result_destroy(pmr);
+    }
+    return NULL;
+}
+
+/* Query the status of [hosts] from several threads sharing handle [pm].
+ */
+static pm_err_t
+hosts_threads(pm_handle_t pm, char *hosts)
+{
+    struct query_thread q[NTHREADS];
+    int i;
+
+    for (i = 0; i < NTHREADS; i++) {
+        q[i].pm = pm;
+        q[i].hosts = hosts;
+        q[i].ok = 0;
+        if (pthread_create(&q[i].t, NULL, query_thread, &q[i]) != 0)
+            return PM_ERRNOVALID;
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        pthread_join(q[i].t, NULL);
+        printf("thread %d: %d of %d queries succeeded\n", i, q[i].ok,
+               NQUERIES);
+    }
+    return PM_ESUCCESS;
+}
+
 static void
 usage(void)
 {
     fprintf(stderr, "Usage: cli host:port 0|1|q node\n");
+    fprintf(stderr, "       cli host:port Q|a|p|t hosts\n");
     fprintf(stderr, "       cli host:port l\n");
     exit(1);
 }
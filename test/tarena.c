@@ -0,0 +1,86 @@
+/*****************************************************************************
+ *  Copyright (C) 2004 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+int
+main(int argc, char *argv[])
+{
+	Arena a;
+	char *s, *t, *big;
+	int i, j;
+
+	a = arena_create(128);
+	assert(arena_allocs(a) == 0);
+	assert(arena_heap_allocs(a) == 0);
+
+	/* small allocations share a chunk, are aligned and zeroed */
+	for (i = 1; i <= 4; i++) {
+		s = arena_alloc(a, i);
+		assert(((uintptr_t)s & 15) == 0);
+		for (j = 0; j < i; j++)
+			assert(s[j] == 0);
+		memset(s, 0xff, i);
+	}
+	assert(arena_allocs(a) == 4);
+	assert(arena_heap_allocs(a) == 1);
+
+	/* a large allocation gets its own chunk but the head is kept */
+	big = arena_alloc(a, 1000);
+	s = arena_strdup(a, "foo");
+	assert(strcmp(s, "foo") == 0);
+	assert(arena_heap_allocs(a) == 2);
+	memset(big, 'x', 1000);
+
+	/* sprintf both within the head chunk and past its end */
+	s = arena_sprintf(a, "%s-%d", "bar", 42);
+	assert(strcmp(s, "bar-42") == 0);
+	t = arena_sprintf(a, "%.*s", 200, big);
+	assert(strlen(t) == 200 && t[0] == 'x');
+	assert(strcmp(s, "bar-42") == 0);
+	assert(arena_heap_allocs(a) == 3);
+	s = arena_memdup(a, "bazbonk", 3);
+	assert(strcmp(s, "baz") == 0);
+	assert(arena_allocs(a) == 9);
+	assert(arena_heap_allocs(a) == 3);
+
+	/* reset releases everything and keeps one chunk of zeroed memory */
+	arena_reset(a);
+	assert(arena_allocs(a) == 0);
+	assert(arena_heap_allocs(a) == 0);
+	s = arena_alloc(a, 64);
+	for (i = 0; i < 64; i++)
+		assert(s[i] == 0);
+	assert(arena_heap_allocs(a) == 0);
+
+	arena_destroy(a);
+	exit(0);
+}
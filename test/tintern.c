@@ -0,0 +1,60 @@
+/*****************************************************************************
+ *  Copyright (C) 2004 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "hostlist.h"
+#include "intern.h"
+
+#define NAMES   1024
+
+int
+main(int argc, char *argv[])
+{
+	char name[16];
+	char *names[NAMES];
+	int used[NAMES] = { 0 };
+	int i, buckets = 0;
+
+	for (i = 0; i < NAMES; i++) {
+		snprintf(name, sizeof(name), "n%d", i);
+		names[i] = intern(name);
+		assert(intern(name) == names[i]);
+	}
+
+	/* interned names are spread over a table sized for them about
+	 * as well as random keys would be (1 - 1/e of the buckets) */
+	for (i = 0; i < NAMES; i++) {
+		if (!used[intern_hash_key(names[i]) % NAMES]++)
+			buckets++;
+	}
+	assert(buckets > NAMES / 2);
+
+	intern_fini();
+	exit(0);
+}
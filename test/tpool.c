@@ -0,0 +1,79 @@
+/*****************************************************************************
+ *  Copyright (C) 2004 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <assert.h>
+
+#include "pool.h"
+
+static int live = 0;
+
+static void *
+_create(void)
+{
+	live++;
+	return malloc(16);
+}
+
+static void
+_destroy(void *obj)
+{
+	live--;
+	free(obj);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Pool p;
+	void *a, *b, *c;
+
+	p = pool_create(2, _create, _destroy);
+	a = pool_get(p);
+	b = pool_get(p);
+	c = pool_get(p);
+	assert(live == 3);
+	assert(pool_creates(p) == 3);
+
+	/* only two are retained */
+	pool_put(p, a);
+	pool_put(p, b);
+	pool_put(p, c);
+	assert(live == 2);
+
+	/* most recently released is reused first, without creating */
+	assert(pool_get(p) == b);
+	assert(pool_get(p) == a);
+	assert(pool_gets(p) == 5);
+	assert(pool_creates(p) == 3);
+
+	pool_put(p, a);
+	pool_destroy(p);
+	assert(live == 1);
+	free(b);
+
+	exit(0);
+}
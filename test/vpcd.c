@@ -56,14 +56,16 @@ static int plug[NUM_PLUGS];
 static int beacon[NUM_PLUGS];
 static int temp[NUM_PLUGS];
 static int logged_in = 0;
+static char *drop_once = NULL;  /* ignore first request if file is absent */
 
 static char *prog;
 
-#define OPTIONS "p:"
+#define OPTIONS "p:d:"
 #if HAVE_GETOPT_LONG
 #define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
 static const struct option longopts[] = {
     {"port", required_argument, 0, 'p'},
+    {"drop-once", required_argument, 0, 'd'},
     {0, 0, 0, 0},
 };
 #else
@@ -83,6 +85,9 @@ main(int argc, char *argv[])
             case 'p':   /* --port n */
                 port = xstrdup(optarg);
                 break;
+            case 'd':   /* --drop-once file */
+                drop_once = xstrdup(optarg);
+                break;
             default:
                 usage();
         }
@@ -294,6 +299,16 @@ _prompt_loop(void)
             printf("%d Please login\n", seq);
             continue;
         }
+        if (drop_once) {                                /* act hung once */
+            FILE *f = NULL;
+
+            if (access(drop_once, F_OK) < 0 && (f = fopen(drop_once, "w")))
+                fclose(f);
+            xfree(drop_once);
+            drop_once = NULL;
+            if (f)
+                continue;
+        }
         if (sscanf(buf, "stat %d", &i) == 1) {         /* stat <plugnum> */
             if (i < 0 || i >= NUM_PLUGS) {
                 printf("%d BADVAL: %d\n", seq, i);